@@ -0,0 +1,193 @@
+/**
+ * Host check of the batch session and of the fault attribution that feeds it
+ *
+ * Scripted 3x3 scans ([drive][sense] in mV, as testWiresOnByOne leaves measurements) of good and faulty body cords
+ * go through cordWireFaults, the way wire test phase 1 takes them: the faults and leads of the last scan with the
+ * cord still plugged in count, a lead for every wire that is connected without a short, green, yellow or orange.
+ * The resulting records go into a BatchSession, and its statistics are compared with values worked out by hand:
+ *   - fault attribution: short, swapped, broken, and a cord pulled out (the unplugged scan must not add breaks)
+ *   - a brief touch (shorter than BATCH_MIN_CORD_MS) is left out, a passing yellow or orange cord is not
+ *   - pass and fault counts, lead distribution, durations and throughput
+ *   - the record ring keeps the latest BATCH_MAX_RECORDS cords, the totals cover all of them
+ *
+ * Exits with 1 when any check fails.
+ *
+ * Build and run on the host from the repository root:
+ *   g++ -O2 -std=gnu++11 -o batch_session_check batch_session_check.cpp src/BatchSession.cpp src/BodyCordCheck.cpp
+ *   ./batch_session_check
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "src/BatchSession.h"
+#include "src/BodyCordCheck.h"
+
+const int OHM_MV = 25;  // Calibration without leads, 1 Ohm is about 25 mV
+const int OPEN_MV = 4000;
+const int LEAD_MV = 15;  // A good wire, 0.6 Ohm
+
+// The Tester's references with that calibration: ReferenceBroken, ReferenceGreen, ReferenceYellow, ReferenceShort
+const CordReferences references = {10 * OHM_MV, 1 * OHM_MV, 3 * OHM_MV, CONNECTED_MV};
+
+struct Scan {
+    int mv[3][3];
+};
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    printf("  %-58s %s\n", what, ok ? "ok" : "FAIL");
+    failures += !ok;
+}
+
+Scan openScan() {
+    Scan scan;
+    for (int drive = 0; drive < 3; drive++) {
+        for (int sense = 0; sense < 3; sense++) {
+            scan.mv[drive][sense] = OPEN_MV;
+        }
+    }
+    return scan;
+}
+
+Scan goodScan() {
+    Scan scan = openScan();
+    for (int wire = 0; wire < 3; wire++) {
+        scan.mv[wire][wire] = LEAD_MV;
+    }
+    return scan;
+}
+
+// A scan of a good cord with these leads
+Scan leadScan(float ohm0, float ohm1, float ohm2) {
+    Scan scan = openScan();
+    const float ohm[3] = {ohm0, ohm1, ohm2};
+    for (int wire = 0; wire < 3; wire++) {
+        scan.mv[wire][wire] = (int)(ohm[wire] * OHM_MV + 0.5f);
+    }
+    return scan;
+}
+
+// WirePluggedIn(ReferenceBroken) on a scan
+bool pluggedIn(const Scan& scan) {
+    for (int drive = 0; drive < 3; drive++) {
+        for (int sense = 0; sense < 3; sense++) {
+            if (scan.mv[drive][sense] < references.broken) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// handleWireTestingState1 over a sequence of scans: cordFaults and the leads only follow the scans with the cord
+// plugged in, so the last of those counts
+uint16_t phaseOneFaults(const Scan* scans, int count) {
+    uint16_t faults = 0;
+    for (int i = 0; i < count; i++) {
+        if (pluggedIn(scans[i])) {
+            faults = cordWireFaults(scans[i].mv, references);
+        }
+    }
+    return faults;
+}
+
+// finishCord's record of a cord whose last plugged-in scan was this one; measureCordLeads with the calibration
+// above: a lead for each wire with a level, whatever its color
+CordRecord makeRecord(const Scan& scan, uint32_t durationMs) {
+    CordRecord record = {};
+    record.faults = cordWireFaults(scan.mv, references);
+    record.durationMs = durationMs;
+    for (int wire = 0; wire < 3; wire++) {
+        record.leadMilliOhm[wire] = cordWireLevel(scan.mv, references, wire) < 0
+                                        ? LEAD_NOT_MEASURED
+                                        : (uint16_t)(scan.mv[wire][wire] * 1000.0f / OHM_MV + 0.5f);
+    }
+    return record;
+}
+
+bool near(float value, float expected) { return fabsf(value - expected) < 1e-3f; }
+
+int main() {
+    printf("=== BATCH SESSION CHECK ===\n\nFault attribution:\n");
+
+    Scan shorted = goodScan();  // Wires 0 and 1 touch
+    shorted.mv[0][1] = shorted.mv[1][0] = 10;
+    check(cordWireFaults(shorted.mv, references) ==
+              (wireFaults(0, CORD_FAULT_SHORT) | wireFaults(1, CORD_FAULT_SHORT)),
+          "short between wires 0 and 1");
+
+    Scan swapped = goodScan();  // Wires 1 and 2 crossed over
+    swapped.mv[1][1] = swapped.mv[2][2] = OPEN_MV;
+    swapped.mv[1][2] = swapped.mv[2][1] = LEAD_MV;
+    check(cordWireFaults(swapped.mv, references) ==
+              (wireFaults(1, CORD_FAULT_SWAPPED) | wireFaults(2, CORD_FAULT_SWAPPED)),
+          "wires 1 and 2 swapped");
+
+    Scan broken = goodScan();
+    broken.mv[2][2] = OPEN_MV;
+    check(cordWireFaults(broken.mv, references) == wireFaults(2, CORD_FAULT_BROKEN), "wire 2 broken");
+
+    Scan orange = goodScan();  // Connected, just high: a color, not a fault
+    orange.mv[0][0] = 8 * OHM_MV;
+    check(cordWireFaults(orange.mv, references) == 0, "wire 0 at 8 Ohm is no fault");
+
+    const Scan pulled[] = {goodScan(), goodScan(), openScan()};
+    check(phaseOneFaults(pulled, 3) == 0, "good cord pulled out stays good");
+    const Scan pulledBroken[] = {broken, broken, openScan()};
+    check(phaseOneFaults(pulledBroken, 3) == wireFaults(2, CORD_FAULT_BROKEN),
+          "broken cord pulled out keeps only its own break");
+    const Scan touch[] = {openScan(), openScan()};
+    check(phaseOneFaults(touch, 2) == 0, "brief touch finds no faults");
+
+    check(cordWireLevel(leadScan(2.0f, 2.0f, 2.0f).mv, references, 0) == 1, "wire at 2 Ohm is yellow");
+    check(cordWireLevel(leadScan(0.6f, 0.6f, 4.4f).mv, references, 2) == 2, "wire at 4.4 Ohm is orange");
+
+    printf("\nSession:\n");
+    BatchSession batch;
+    batch.start(1000);
+    // Start at 1 s, one cord every 6 s: 10 cords per minute
+    check(batch.addCord(makeRecord(leadScan(0.4f, 0.6f, 0.8f), 2000), 7000) == 1, "good cord gets sequence 1");
+    check(batch.addCord(makeRecord(goodScan(), 100), 9000) == 0, "brief touch is left out");
+    check(batch.addCord(makeRecord(shorted, BATCH_MIN_CORD_MS - 1), 9500) == 0, "brief faulty touch is left out too");
+    check(batch.addCord(makeRecord(shorted, 3000), 13000) == 2, "shorted cord gets sequence 2");
+    check(batch.addCord(makeRecord(swapped, 4000), 19000) == 3, "swapped cord gets sequence 3");
+    check(batch.addCord(makeRecord(pulledBroken[1], 1000), 25000) == 4, "broken cord gets sequence 4");
+    check(batch.addCord(makeRecord(leadScan(2.0f, 2.0f, 2.0f), 2000), 31000) == 5,
+          "passing 2 Ohm cord gets sequence 5");
+    check(batch.addCord(makeRecord(leadScan(1.6f, 0.6f, 4.4f), 2000), 37000) == 6,
+          "passing cord with an orange wire gets sequence 6");
+
+    check(batch.cords() == 6 && batch.passed() == 3, "6 cords, 3 passed");
+    check(batch.faultCount(CORD_FAULT_SHORT) == 1 && batch.faultCount(CORD_FAULT_SWAPPED) == 1 &&
+              batch.faultCount(CORD_FAULT_BROKEN) == 1,
+          "one short, one swap, one break");
+    check(batch.averageDurationMs() == 2333 && batch.maxDurationMs() == 4000, "durations 2333 ms average, 4000 max");
+    check(batch.sessionMs() == 36000 && near(batch.cordsPerMinute(), 10.0f), "36 s session, 10 cords per minute");
+
+    // Faulty cords still give the leads of their other wires: wire 0 of the swapped and the broken cord, 0.6 Ohm
+    const LeadDistribution& lead0 = batch.lead(0);
+    check(lead0.count == 5 && near(lead0.minOhm, 0.4f) && near(lead0.maxOhm, 2.0f) && near(lead0.mean(), 1.04f),
+          "lead 0: 5 values, 0.4 to 2.0 Ohm, mean 1.04");
+    check(lead0.histogram[1] == 1 && lead0.histogram[2] == 2 && lead0.histogram[6] == 1 && lead0.histogram[8] == 1,
+          "lead 0: 2.0 Ohm kept, in the 2.0 Ohm bin");
+    check(batch.lead(1).count == 4, "lead 1: the short leaves 4 values");
+    check(batch.lead(2).count == 4 && batch.lead(2).histogram[BATCH_HISTOGRAM_BINS - 1] == 1,
+          "lead 2: 4 values, 4.4 Ohm in the last bin");
+
+    printf("\nRecord ring:\n");
+    batch.start(0);
+    const int total = BATCH_MAX_RECORDS + 10;
+    for (int i = 0; i < total; i++) {
+        batch.addCord(makeRecord(i % 2 ? broken : goodScan(), 1000), i * 1000);
+    }
+    check(batch.cords() == (uint32_t)total && batch.passed() == (uint32_t)(total / 2), "totals cover every cord");
+    check(batch.recordCount() == BATCH_MAX_RECORDS, "the ring is full");
+    check(batch.record(0).sequence == total - BATCH_MAX_RECORDS + 1 &&
+              batch.record(BATCH_MAX_RECORDS - 1).sequence == total,
+          "oldest kept record is the 11th, newest the last");
+
+    printf("\n%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * Mains hum rejection of the differential sample estimators
+ *
+ * A synthetic trace: a constant differential voltage plus mains hum (fundamental, 2nd and 3rd harmonic) with a
+ * random phase per reading, gaussian ADC noise and occasional ADC spikes. Each acquisition scheme is run many
+ * times and compared on the error of the reading:
+ *   - back to back: the current getDifferentialSample, samples as fast as adc1_get_raw allows
+ *   - mains sync:   samples spread evenly over one mains period (MainsFrequency setting)
+ *
+ * Build and run on the host from the repository root:
+ *   g++ -O2 -std=gnu++11 -o hum_rejection_analysis hum_rejection_analysis.cpp && ./hum_rejection_analysis
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <random>
+
+#include "src/RobustEstimator.h"
+
+const float TRUE_MV = 1000.0f;
+const float HUM_MV = 60.0f;       // Amplitude of the fundamental
+const float HARMONIC_2 = 0.15f;   // Relative amplitudes
+const float HARMONIC_3 = 0.25f;
+const float NOISE_MV = 4.0f;      // ADC noise, one sigma
+const float SPIKE_RATE = 0.01f;   // Fraction of samples that are an ADC outlier
+const float SPIKE_MV = 400.0f;
+const float POLL_INTERVAL_US = 45.0f;  // Two adc1_get_raw calls per sample pair
+const int TRIALS = 20000;
+
+std::mt19937 rng(12345);
+
+float hum(float tUs, float mainsHz, float phase) {
+    float w = 2.0f * (float)M_PI * mainsHz * tUs * 1e-6f + phase;
+    return HUM_MV * (sinf(w) + HARMONIC_2 * sinf(2 * w + 0.7f) + HARMONIC_3 * sinf(3 * w + 1.3f));
+}
+
+int sampleAt(float tUs, float mainsHz, float phase) {
+    std::normal_distribution<float> noise(0.0f, NOISE_MV);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    float v = TRUE_MV + hum(tUs, mainsHz, phase) + noise(rng);
+    if (uniform(rng) < SPIKE_RATE) {
+        v += uniform(rng) < 0.5f ? SPIKE_MV : -SPIKE_MV;
+    }
+    return (int)lroundf(v);
+}
+
+typedef int (*Estimator)(const int* samples, int count);
+
+template <int N>
+int trimmedMean(const int* samples, int count) {
+    return RobustEstimator<N>::trimmedMean(samples, count);
+}
+
+int plainMean(const int* samples, int count) {
+    long sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    return sum / count;
+}
+
+// intervalUs == 0 spreads the samples over one period of syncHz
+void run(const char* label, int count, float intervalUs, float syncHz, float mainsHz, Estimator estimator) {
+    int samples[64];
+    std::uniform_real_distribution<float> phases(0.0f, 2.0f * (float)M_PI);
+    if (intervalUs == 0) {
+        intervalUs = 1e6f / (syncHz * count);
+    }
+    double sumSquares = 0;
+    float worst = 0;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        float phase = phases(rng);
+        for (int i = 0; i < count; i++) {
+            samples[i] = sampleAt(i * intervalUs, mainsHz, phase);
+        }
+        float error = estimator(samples, count) - TRUE_MV;
+        sumSquares += error * error;
+        if (fabsf(error) > worst) {
+            worst = fabsf(error);
+        }
+    }
+    printf("%-36s %3d samples %7.1f ms   rms %6.2f mV   max %6.1f mV\n", label, count, count * intervalUs / 1000,
+           sqrt(sumSquares / TRIALS), worst);
+}
+
+int main() {
+    printf("=== HUM REJECTION: %.0f mV hum (+%.0f%% 2nd, +%.0f%% 3rd harmonic), %.0f mV noise, %.0f%% spikes ===\n\n",
+           HUM_MV, HARMONIC_2 * 100, HARMONIC_3 * 100, NOISE_MV, SPIKE_RATE * 100);
+
+    printf("50 Hz mains:\n");
+    run("back to back, trimmed mean", 16, POLL_INTERVAL_US, 0, 50, trimmedMean<16>);
+    run("back to back, trimmed mean", 64, POLL_INTERVAL_US, 0, 50, trimmedMean<64>);
+    run("mains sync 50 Hz, trimmed mean", 8, 0, 50, 50, trimmedMean<8>);
+    run("mains sync 50 Hz, trimmed mean", 16, 0, 50, 50, trimmedMean<16>);
+    run("mains sync 50 Hz, plain mean", 16, 0, 50, 50, plainMean);
+
+    printf("\nMains off nominal (49.5 Hz) and wrong setting:\n");
+    run("mains sync 50 Hz on 49.5 Hz", 16, 0, 50, 49.5f, trimmedMean<16>);
+    run("mains sync 50 Hz on 60 Hz", 16, 0, 50, 60, trimmedMean<16>);
+    run("mains sync 60 Hz on 60 Hz", 16, 0, 60, 60, trimmedMean<16>);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * Live pair tracking with ScalarKalman, as trackPair configures it
+ *
+ * Each reading fed to the filter is the median of TRACK_SAMPLES differential samples, modelled here as a gaussian
+ * around the true level with TRACK_MEASUREMENT_NOISE_MV. For many independent runs the tool reports:
+ *   - settling on a constant level: rms and worst error of the filtered value after n readings
+ *   - false steps: readings on a constant level that restarted the filter
+ *   - steps: rms error after n readings of a new level, for small and large steps, and how often the first
+ *     reading of the new level restarted the filter on it
+ *
+ * Checks the figures the TrackLive setting was introduced with: a 300 mV level with 8 mV noise settles to within
+ * about 4 mV, and a step to 700 mV is followed on the first reading. Exits with 1 when either does not hold.
+ *
+ * Build and run on the host from the repository root:
+ *   g++ -O2 -std=gnu++11 -o kalman_tracking_analysis kalman_tracking_analysis.cpp && ./kalman_tracking_analysis
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <random>
+
+#include "src/ScalarKalman.h"
+
+// Copied from resitancemeasurement.cpp, keep in sync
+const float TRACK_PROCESS_NOISE_MV = 2.0f;
+const float TRACK_MEASUREMENT_NOISE_MV = 8.0f;
+const float TRACK_STEP_SIGMAS = 4.0f;
+const float TRACK_STEP_MIN_MV = 30.0f;
+
+const float LEVEL_MV = 300.0f;
+const float STEP_TO_MV = 700.0f;
+const float CLOSE_MV = 4.0f;  // "Within about 4 mV"
+const int SETTLE_READINGS = 16;
+const int MAX_READINGS = 64;
+const int TRIALS = 20000;
+
+std::mt19937 rng(12345);
+std::normal_distribution<float> noise(0.0f, TRACK_MEASUREMENT_NOISE_MV);
+
+void configure(ScalarKalman& filter) {
+    filter.configure(TRACK_PROCESS_NOISE_MV, TRACK_MEASUREMENT_NOISE_MV, TRACK_STEP_SIGMAS, TRACK_STEP_MIN_MV);
+}
+
+// Error of the filtered value after each of the first MAX_READINGS readings of a constant level
+void settling(float* rmsAfter, float* maxAfter, long& falseSteps) {
+    double sumSquares[MAX_READINGS] = {0};
+    falseSteps = 0;
+    for (int i = 0; i < MAX_READINGS; i++) {
+        maxAfter[i] = 0.0f;
+    }
+    for (int t = 0; t < TRIALS; t++) {
+        ScalarKalman filter;
+        configure(filter);
+        for (int i = 0; i < MAX_READINGS; i++) {
+            if (filter.update(LEVEL_MV + noise(rng)) && i > 0) {
+                falseSteps++;
+            }
+            float error = fabsf(filter.value() - LEVEL_MV);
+            sumSquares[i] += error * error;
+            if (error > maxAfter[i]) {
+                maxAfter[i] = error;
+            }
+        }
+    }
+    for (int i = 0; i < MAX_READINGS; i++) {
+        rmsAfter[i] = sqrtf(sumSquares[i] / TRIALS);
+    }
+}
+
+// rms error of the filtered value after each of the first MAX_READINGS readings of a new level, on a filter that
+// settled on LEVEL_MV first. `restarts` counts the runs that restarted on the first reading of the new level.
+void step(float toMv, float* rmsAfter, long& restarts) {
+    double sumSquares[MAX_READINGS] = {0};
+    restarts = 0;
+    for (int t = 0; t < TRIALS; t++) {
+        ScalarKalman filter;
+        configure(filter);
+        for (int i = 0; i < SETTLE_READINGS; i++) {
+            filter.update(LEVEL_MV + noise(rng));
+        }
+        for (int i = 0; i < MAX_READINGS; i++) {
+            if (filter.update(toMv + noise(rng)) && i == 0) {
+                restarts++;
+            }
+            float error = filter.value() - toMv;
+            sumSquares[i] += error * error;
+        }
+    }
+    for (int i = 0; i < MAX_READINGS; i++) {
+        rmsAfter[i] = sqrtf(sumSquares[i] / TRIALS);
+    }
+}
+
+int main() {
+    printf("=== KALMAN TRACKING: q %.0f mV, r %.0f mV, step at %.0f sigmas and %.0f mV, %d runs ===\n\n",
+           TRACK_PROCESS_NOISE_MV, TRACK_MEASUREMENT_NOISE_MV, TRACK_STEP_SIGMAS, TRACK_STEP_MIN_MV, TRIALS);
+
+    float rmsAfter[MAX_READINGS];
+    float maxAfter[MAX_READINGS];
+    long falseSteps;
+    settling(rmsAfter, maxAfter, falseSteps);
+    printf("Constant %.0f mV, %.0f mV noise per reading:\n", LEVEL_MV, TRACK_MEASUREMENT_NOISE_MV);
+    const int shown[] = {1, 2, 4, 8, 16, 32, 64};
+    for (int n : shown) {
+        printf("  after %2d readings   rms %5.2f mV   max %6.2f mV\n", n, rmsAfter[n - 1], maxAfter[n - 1]);
+    }
+    printf("  false steps        %ld of %ld readings\n\n", falseSteps, (long)TRIALS * (MAX_READINGS - 1));
+
+    printf("Step from %.0f mV after %d readings, rms error after n readings of the new level:\n", LEVEL_MV,
+           SETTLE_READINGS);
+    const float steps[] = {LEVEL_MV + 20.0f, LEVEL_MV + 40.0f, LEVEL_MV + 100.0f, STEP_TO_MV};
+    long stepRestarts = 0;
+    for (float toMv : steps) {
+        float stepRms[MAX_READINGS];
+        long restarts;
+        step(toMv, stepRms, restarts);
+        printf("  to %4.0f mV   restarted %5.1f%%   rms", toMv, 100.0f * restarts / TRIALS);
+        for (int n : shown) {
+            printf("  %2d: %5.1f", n, stepRms[n - 1]);
+        }
+        printf(" mV\n");
+        if (toMv == STEP_TO_MV) {
+            stepRestarts = restarts;
+        }
+    }
+
+    // The steady state the claim is about: rms error once the filter has had SETTLE_READINGS readings
+    bool settles = rmsAfter[SETTLE_READINGS - 1] <= CLOSE_MV;
+    bool follows = stepRestarts == TRIALS;
+    printf("\nSettles to within %.0f mV rms after %d readings: %s (%.2f mV)\n", CLOSE_MV, SETTLE_READINGS,
+           settles ? "yes" : "NO", rmsAfter[SETTLE_READINGS - 1]);
+    printf("Step to %.0f mV taken on the first reading: %s\n", STEP_TO_MV, follows ? "yes" : "NO");
+    return settles && follows ? 0 : 1;
+}
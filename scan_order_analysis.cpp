@@ -0,0 +1,149 @@
+/**
+ * Scan order optimisation for testWiresOnByOne
+ *
+ * Every switch between two drive patterns flips some of the 7 driver pins between input and output, or
+ * changes the level of a pin that stays an output. Each flip disturbs the nodes we are about to sample.
+ * This tool finds the order of the 9 scan patterns with the lowest total switching cost (Held-Karp, exact),
+ * taking into account the patterns the waiting loop uses around the scan:
+ *   ... testAlBl() -> [scan] -> testArCr() ...
+ *
+ * Build and run on the host: g++ -O2 -o scan_order_analysis scan_order_analysis.cpp && ./scan_order_analysis
+ * Paste the printed SCAN_ORDER_MIN_SWITCHING table into resitancemeasurement.h.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Copied from resitancemeasurement.cpp, bit set = input, driver bit order al, bl, cl, ar, br, cr, piste
+struct Pattern {
+    const char* name;
+    const char* pair;  // Pair_t name
+    uint8_t direction;
+    uint8_t values;
+};
+
+const Pattern scanPatterns[9] = {
+    {"CrCl", "PAIR_CR_CL", 219, 32}, {"CrPiste", "PAIR_CR_PISTE", 159, 32}, {"CrBl", "PAIR_CR_BL", 221, 32},
+    {"ArCl", "PAIR_AR_CL", 243, 8},  {"ArPiste", "PAIR_AR_PISTE", 183, 8},  {"ArBl", "PAIR_AR_BL", 245, 8},
+    {"BrCl", "PAIR_BR_CL", 235, 16}, {"BrPiste", "PAIR_BR_PISTE", 175, 16}, {"BrBl", "PAIR_BR_BL", 237, 16},
+};
+const Pattern before = {"AlBl (ClPiste)", "PAIR_CL_PISTE", 187, 4};
+const Pattern after = {"ArCr", "PAIR_AR_CR", 215, 8};
+
+const int NUM_DRIVERS = 7;
+const int DIRECTION_WEIGHT = 2;  // Pin changes between input and output, its node has to recharge
+const int LEVEL_WEIGHT = 1;      // Output stays an output but changes level
+
+int switchCost(const Pattern& from, const Pattern& to) {
+    int cost = 0;
+    for (int i = 0; i < NUM_DRIVERS; i++) {
+        bool inFrom = (from.direction >> i) & 1;
+        bool inTo = (to.direction >> i) & 1;
+        if (inFrom != inTo) {
+            cost += DIRECTION_WEIGHT;
+        } else if (!inFrom && (((from.values ^ to.values) >> i) & 1)) {
+            cost += LEVEL_WEIGHT;
+        }
+    }
+    return cost;
+}
+
+int orderCost(const int* order) {
+    int cost = switchCost(before, scanPatterns[order[0]]);
+    for (int i = 1; i < 9; i++) {
+        cost += switchCost(scanPatterns[order[i - 1]], scanPatterns[order[i]]);
+    }
+    return cost + switchCost(scanPatterns[order[8]], after);
+}
+
+// best[mask][last]: lowest cost to visit the patterns in mask, starting from `before` and ending on `last`
+int best[1 << 9][9];
+int previous[1 << 9][9];
+
+void findBestOrder(int* order) {
+    const int INF = 1 << 30;
+    for (int mask = 0; mask < (1 << 9); mask++) {
+        for (int last = 0; last < 9; last++) {
+            best[mask][last] = INF;
+        }
+    }
+    for (int first = 0; first < 9; first++) {
+        best[1 << first][first] = switchCost(before, scanPatterns[first]);
+        previous[1 << first][first] = -1;
+    }
+    for (int mask = 1; mask < (1 << 9); mask++) {
+        for (int last = 0; last < 9; last++) {
+            if (best[mask][last] == INF) {
+                continue;
+            }
+            for (int next = 0; next < 9; next++) {
+                if (mask & (1 << next)) {
+                    continue;
+                }
+                int cost = best[mask][last] + switchCost(scanPatterns[last], scanPatterns[next]);
+                if (cost < best[mask | (1 << next)][next]) {
+                    best[mask | (1 << next)][next] = cost;
+                    previous[mask | (1 << next)][next] = last;
+                }
+            }
+        }
+    }
+
+    int full = (1 << 9) - 1;
+    int last = 0;
+    int lowest = INF;
+    for (int i = 0; i < 9; i++) {
+        int cost = best[full][i] + switchCost(scanPatterns[i], after);
+        if (cost < lowest) {
+            lowest = cost;
+            last = i;
+        }
+    }
+    int mask = full;
+    for (int i = 8; i >= 0; i--) {
+        order[i] = last;
+        int prev = previous[mask][last];
+        mask &= ~(1 << last);
+        last = prev;
+    }
+}
+
+void printOrder(const char* label, const int* order) {
+    printf("%-10s cost %3d: %s", label, orderCost(order), before.name);
+    for (int i = 0; i < 9; i++) {
+        printf(" -> %s", scanPatterns[order[i]].name);
+    }
+    printf(" -> %s\n", after.name);
+}
+
+int main() {
+    printf("=== SCAN ORDER: pattern switching cost (direction change %d, level change %d) ===\n\n",
+           DIRECTION_WEIGHT, LEVEL_WEIGHT);
+
+    printf("Switch cost matrix (from row to column):\n         ");
+    for (int j = 0; j < 9; j++) {
+        printf("%8s", scanPatterns[j].name);
+    }
+    printf("\n");
+    for (int i = 0; i < 9; i++) {
+        printf("%-9s", scanPatterns[i].name);
+        for (int j = 0; j < 9; j++) {
+            printf("%8d", switchCost(scanPatterns[i], scanPatterns[j]));
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    int original[9] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+    int optimal[9];
+    findBestOrder(optimal);
+    printOrder("original", original);
+    printOrder("optimal", optimal);
+
+    printf("\nconstexpr Pair_t SCAN_ORDER_MIN_SWITCHING[9] = {");
+    for (int i = 0; i < 9; i++) {
+        printf("%s%s", i ? ", " : "", scanPatterns[optimal[i]].pair);
+    }
+    printf("};\n");
+    return 0;
+}
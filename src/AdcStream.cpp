@@ -0,0 +1,148 @@
+#include "AdcStream.h"
+
+#include "Hardware.h"
+#include "esp_task_wdt.h"
+
+AdcStream& AdcStream::getInstance() {
+    static AdcStream instance;
+    return instance;
+}
+
+AdcStream::AdcStream()
+    : initialized(false), running(false), currentChannels{ADC1_CHANNEL_MAX, ADC1_CHANNEL_MAX}, sampleFreqHz(0) {}
+
+bool AdcStream::begin(uint32_t freqHz) {
+    if (initialized) {
+        return true;
+    }
+    sampleFreqHz = freqHz;
+
+    // All channels the tester can ever read, the pattern only selects two of them at a time
+    adc_digi_init_config_t init_config = {};
+    init_config.max_store_buf_size = ADC_STREAM_BUFFER_BYTES;
+    init_config.conv_num_each_intr = ADC_STREAM_FRAME_BYTES;
+    init_config.adc1_chan_mask =
+        BIT(cl_analog) | BIT(bl_analog) | BIT(piste_analog) | BIT(cr_analog) | BIT(br_analog) | BIT(ar_analog);
+    init_config.adc2_chan_mask = 0;
+    if (adc_digi_initialize(&init_config) != ESP_OK) {
+        printf("AdcStream: adc_digi_initialize failed\n");
+        return false;
+    }
+    initialized = true;
+
+    // Start on the pair init_AD leaves the drivers in
+    if (!configure(ar_analog, br_analog) || adc_digi_start() != ESP_OK) {
+        printf("AdcStream: could not start the ADC digital controller\n");
+        end();
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void AdcStream::end() {
+    if (running) {
+        adc_digi_stop();
+        running = false;
+    }
+    if (initialized) {
+        adc_digi_deinitialize();
+        initialized = false;
+    }
+    currentChannels[0] = ADC1_CHANNEL_MAX;
+    currentChannels[1] = ADC1_CHANNEL_MAX;
+    // Hand ADC1 back to the one-shot driver
+    adc1_config_width(ADC_WIDTH_BIT_12);
+}
+
+bool AdcStream::configure(adc1_channel_t ch1, adc1_channel_t ch2) {
+    adc_digi_pattern_config_t pattern[2] = {};
+    adc1_channel_t channels[2] = {ch1, ch2};
+    for (int i = 0; i < 2; i++) {
+        pattern[i].atten = ADC_ATTEN_DB_11;
+        pattern[i].channel = channels[i];
+        pattern[i].unit = 0;  // ADC1
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = true;  // Required on the ESP32
+    config.conv_limit_num = 250;
+    config.pattern_num = 2;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = sampleFreqHz;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+    if (adc_digi_controller_configure(&config) != ESP_OK) {
+        return false;
+    }
+    currentChannels[0] = ch1;
+    currentChannels[1] = ch2;
+    return true;
+}
+
+bool AdcStream::selectChannels(adc1_channel_t ch1, adc1_channel_t ch2) {
+    if (!initialized) {
+        return false;
+    }
+    if ((currentChannels[0] == ch1 && currentChannels[1] == ch2) ||
+        (currentChannels[0] == ch2 && currentChannels[1] == ch1)) {
+        return true;
+    }
+    // The pattern table can only be changed while the controller is stopped
+    adc_digi_stop();
+    running = false;
+    if (!configure(ch1, ch2)) {
+        return false;
+    }
+    running = (adc_digi_start() == ESP_OK);
+    return running;
+}
+
+void AdcStream::flush() {
+    uint32_t length = 0;
+    // ESP_ERR_INVALID_STATE only reports that the ring buffer overflowed, the data is still returned
+    for (int i = 0; i < (int)(ADC_STREAM_BUFFER_BYTES / ADC_STREAM_FRAME_BYTES) + 1; i++) {
+        esp_err_t err = adc_digi_read_bytes(frame, sizeof(frame), &length, 0);
+        if ((err != ESP_OK && err != ESP_ERR_INVALID_STATE) || length == 0) {
+            break;
+        }
+    }
+}
+
+int AdcStream::readPair(adc1_channel_t ch1, adc1_channel_t ch2, int* samples1, int* samples2, int nr_samples,
+                        bool fresh) {
+    if (!running || !selectChannels(ch1, ch2)) {
+        return 0;
+    }
+    if (fresh) {
+        flush();
+    }
+
+    int count1 = 0;
+    int count2 = 0;
+    // The frame in flight while flushing may still hold conversions from before the drive pattern switch
+    bool skipFrame = fresh;
+    unsigned long start = millis();
+    while ((count1 < nr_samples || count2 < nr_samples) && (millis() - start) < ADC_STREAM_TIMEOUT_MS) {
+        uint32_t length = 0;
+        esp_err_t err = adc_digi_read_bytes(frame, sizeof(frame), &length, ADC_STREAM_TIMEOUT_MS);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+            break;
+        }
+        if (skipFrame) {
+            skipFrame = false;
+            continue;
+        }
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            const adc_digi_output_data_t* result = reinterpret_cast<const adc_digi_output_data_t*>(&frame[i]);
+            if (result->type1.channel == ch1 && count1 < nr_samples) {
+                samples1[count1++] = result->type1.data;
+            } else if (result->type1.channel == ch2 && count2 < nr_samples) {
+                samples2[count2++] = result->type1.data;
+            }
+        }
+    }
+    esp_task_wdt_reset();
+    return count1 < count2 ? count1 : count2;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "driver/adc.h"
+
+// Total conversion rate of the digital controller, shared by the channels in the pattern
+constexpr uint32_t ADC_STREAM_SAMPLE_FREQ_HZ = 500000;
+// Bytes per DMA frame, one conversion result is SOC_ADC_DIGI_RESULT_BYTES
+constexpr uint32_t ADC_STREAM_FRAME_BYTES = 64;
+constexpr uint32_t ADC_STREAM_BUFFER_BYTES = 1024;
+constexpr uint32_t ADC_STREAM_TIMEOUT_MS = 20;
+
+// Continuous ADC1 acquisition through the ADC digital controller and DMA.
+// The controller converts an alternating two-channel pattern in the background and the results
+// are demultiplexed on their channel tag, so the CPU never waits for a single conversion.
+// While the stream is running adc1_get_raw must not be used.
+class AdcStream {
+   private:
+    bool initialized;
+    bool running;
+    adc1_channel_t currentChannels[2];
+    uint32_t sampleFreqHz;
+    uint8_t frame[ADC_STREAM_FRAME_BYTES];
+
+    AdcStream();
+    AdcStream(const AdcStream&) = delete;
+    AdcStream& operator=(const AdcStream&) = delete;
+
+    bool configure(adc1_channel_t ch1, adc1_channel_t ch2);
+
+   public:
+    static AdcStream& getInstance();
+
+    // Sets up the DMA controller for all measurement channels and starts converting
+    bool begin(uint32_t freqHz = ADC_STREAM_SAMPLE_FREQ_HZ);
+    // Stops and releases the controller, adc1_get_raw can be used again afterwards
+    void end();
+    bool isRunning() const { return running; }
+
+    // Switches the conversion pattern to ch1/ch2 (no-op if already selected)
+    bool selectChannels(adc1_channel_t ch1, adc1_channel_t ch2);
+    // Drops all conversions that were buffered before this call
+    void flush();
+    // Fills samples1/samples2 with raw conversions of ch1/ch2. With `fresh` everything converted before
+    // the call is dropped first, without it the read continues where the previous one stopped.
+    // Returns the number of sample pairs collected, less than nr_samples only on timeout.
+    int readPair(adc1_channel_t ch1, adc1_channel_t ch2, int* samples1, int* samples2, int nr_samples,
+                 bool fresh = true);
+};
+
+inline AdcStream& adcStream() { return AdcStream::getInstance(); }
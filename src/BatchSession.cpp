@@ -0,0 +1,86 @@
+#include "BatchSession.h"
+
+#include <math.h>
+
+float LeadDistribution::standardDeviation() const {
+    if (count < 2) {
+        return 0.0f;
+    }
+    float variance = (sumSquares - sum * sum / count) / (count - 1);
+    return variance > 0.0f ? sqrtf(variance) : 0.0f;
+}
+
+void BatchSession::start(uint32_t nowMs) {
+    // Field by field, the records are overwritten as cords come in and do not need clearing
+    total = 0;
+    good = 0;
+    broken = 0;
+    shorts = 0;
+    swapped = 0;
+    durationSumMs = 0;
+    durationMaxMs = 0;
+    for (LeadDistribution& lead : leads) {
+        lead = {};
+    }
+    active = true;
+    startMs = nowMs;
+    lastCordEndMs = nowMs;
+}
+
+uint16_t BatchSession::addCord(CordRecord record, uint32_t nowMs) {
+    if (record.durationMs < BATCH_MIN_CORD_MS) {
+        return 0;
+    }
+    record.sequence = (uint16_t)(total + 1);
+    records[total % BATCH_MAX_RECORDS] = record;
+    total++;
+    lastCordEndMs = nowMs;
+    durationSumMs += record.durationMs;
+    durationMaxMs = record.durationMs > durationMaxMs ? record.durationMs : durationMaxMs;
+
+    bool anyBroken = false;
+    bool anyShort = false;
+    bool anySwapped = false;
+    for (int wire = 0; wire < 3; wire++) {
+        uint8_t faults = (record.faults >> (3 * wire)) & 7;
+        anyBroken |= faults & CORD_FAULT_BROKEN;
+        anyShort |= faults & CORD_FAULT_SHORT;
+        anySwapped |= faults & CORD_FAULT_SWAPPED;
+
+        if (record.leadMilliOhm[wire] == LEAD_NOT_MEASURED) {
+            continue;
+        }
+        float ohm = record.leadMilliOhm[wire] / 1000.0f;
+        LeadDistribution& lead = leads[wire];
+        lead.minOhm = lead.count == 0 || ohm < lead.minOhm ? ohm : lead.minOhm;
+        lead.maxOhm = lead.count == 0 || ohm > lead.maxOhm ? ohm : lead.maxOhm;
+        lead.count++;
+        lead.sum += ohm;
+        lead.sumSquares += ohm * ohm;
+        int bin = (int)(ohm / BATCH_HISTOGRAM_BIN_OHM);
+        lead.histogram[bin < BATCH_HISTOGRAM_BINS ? bin : BATCH_HISTOGRAM_BINS - 1]++;
+    }
+    good += record.faults == 0;
+    broken += anyBroken;
+    shorts += anyShort;
+    swapped += anySwapped;
+    return record.sequence;
+}
+
+uint32_t BatchSession::faultCount(uint8_t category) const {
+    switch (category) {
+        case CORD_FAULT_BROKEN:
+            return broken;
+        case CORD_FAULT_SHORT:
+            return shorts;
+        case CORD_FAULT_SWAPPED:
+            return swapped;
+        default:
+            return 0;
+    }
+}
+
+const CordRecord& BatchSession::record(int index) const {
+    int oldest = total < BATCH_MAX_RECORDS ? 0 : total % BATCH_MAX_RECORDS;
+    return records[(oldest + index) % BATCH_MAX_RECORDS];
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fault categories of a cord, per wire 3 bits at bit 3 * wire
+constexpr uint8_t CORD_FAULT_BROKEN = 1;
+constexpr uint8_t CORD_FAULT_SHORT = 2;
+constexpr uint8_t CORD_FAULT_SWAPPED = 4;
+constexpr uint16_t wireFaults(int wire, uint8_t faults) { return faults << (3 * wire); }
+
+// One tested cord, 16 bytes
+struct CordRecord {
+    uint16_t sequence;
+    uint16_t faults;           // wireFaults() of the three wires, 0 for a good cord
+    uint32_t durationMs;       // Plug-in to the last scan that still saw the cord plugged in
+    uint16_t leadMilliOhm[3];  // LEAD_NOT_MEASURED when the wire was not connected, or 65 Ohm and more
+};
+
+constexpr int BATCH_MAX_RECORDS = 256;  // The latest cords kept one by one, the totals cover the whole session
+constexpr int BATCH_HISTOGRAM_BINS = 16;
+constexpr float BATCH_HISTOGRAM_BIN_OHM = 0.25f;  // Last bin: everything from 3.75 Ohm up
+constexpr uint16_t LEAD_NOT_MEASURED = 0xFFFF;
+constexpr uint32_t BATCH_MIN_CORD_MS = 250;  // Anything plugged in for less only touched the plugs briefly
+
+// Running distribution of one wire's lead resistance
+struct LeadDistribution {
+    uint32_t count;
+    float minOhm;
+    float maxOhm;
+    float sum;
+    float sumSquares;
+    uint16_t histogram[BATCH_HISTOGRAM_BINS];
+
+    float mean() const { return count ? sum / count : 0.0f; }
+    float standardDeviation() const;
+};
+
+// A batch of cords tested one after the other, everything in RAM. Cords get consecutive sequence numbers from 1;
+// per wire the lead resistances go into a distribution, faults are counted per category, and the test durations
+// and the session time give the throughput.
+class BatchSession {
+   public:
+    // Starts a new session at nowMs and forgets the previous one
+    void start(uint32_t nowMs);
+    void stop() { active = false; }
+    bool isActive() const { return active; }
+
+    // Records a finished cord, the sequence number is filled in and returned. A record shorter than
+    // BATCH_MIN_CORD_MS is something that touched the plugs briefly: it is left out and 0 is returned.
+    uint16_t addCord(CordRecord record, uint32_t nowMs);
+
+    uint32_t cords() const { return total; }
+    uint32_t passed() const { return good; }
+    uint32_t faultCount(uint8_t category) const;
+    const LeadDistribution& lead(int wire) const { return leads[wire]; }
+    uint32_t averageDurationMs() const { return total ? (uint32_t)(durationSumMs / total) : 0; }
+    uint32_t maxDurationMs() const { return durationMaxMs; }
+    uint32_t sessionMs() const { return lastCordEndMs - startMs; }
+    float cordsPerMinute() const { return sessionMs() ? total * 60000.0f / sessionMs() : 0.0f; }
+
+    // The kept records, 0 is the oldest
+    int recordCount() const { return total < BATCH_MAX_RECORDS ? total : BATCH_MAX_RECORDS; }
+    const CordRecord& record(int index) const;
+
+   private:
+    bool active = false;
+    uint32_t startMs = 0;
+    uint32_t lastCordEndMs = 0;
+    uint32_t total = 0;
+    uint32_t good = 0;
+    uint32_t broken = 0;
+    uint32_t shorts = 0;
+    uint32_t swapped = 0;
+    uint64_t durationSumMs = 0;
+    uint32_t durationMaxMs = 0;
+    LeadDistribution leads[3] = {};
+    CordRecord records[BATCH_MAX_RECORDS];
+};
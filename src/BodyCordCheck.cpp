@@ -0,0 +1,95 @@
+#include "BodyCordCheck.h"
+
+int cordWireLevel(const int measurements[3][3], const CordReferences& references, int wire) {
+    const int* row = measurements[wire];
+    if (row[wire] >= references.broken || row[(wire + 1) % 3] <= CROSS_SHORT_MV ||
+        row[(wire + 2) % 3] <= CROSS_SHORT_MV) {
+        return -1;
+    }
+    if (row[wire] <= references.green) {
+        return 0;
+    }
+    return row[wire] <= references.yellow ? 1 : 2;
+}
+
+uint16_t cordWireFaults(const int measurements[3][3], const CordReferences& references) {
+    uint16_t faults = 0;
+    for (int i = 0; i < 3; i++) {
+        if (cordWireLevel(measurements, references, i) >= 0) {
+            continue;
+        }
+        const int* row = measurements[i];
+        if (row[i] < references.broken) {
+            faults |= wireFaults(i, CORD_FAULT_SHORT);
+        } else if (row[(i + 1) % 3] > references.shortMv && row[(i + 2) % 3] > references.shortMv) {
+            faults |= wireFaults(i, CORD_FAULT_BROKEN);
+        } else {
+            faults |= wireFaults(i, CORD_FAULT_SWAPPED);
+        }
+    }
+    return faults;
+}
+
+void ExpressCordCheck::start(uint32_t nowMs) {
+    current = EXPRESS_SETTLING;
+    startMs = nowMs;
+    stableSinceMs = nowMs;
+    stableScans = 0;
+    faultBits = 0;
+    for (int i = 0; i < 3; i++) {
+        levels[i] = -2;
+        dropouts[i] = 0;
+    }
+}
+
+ExpressEvent_t ExpressCordCheck::tick(const int measurements[3][3], const CordReferences& references,
+                                      bool pluggedIn, uint32_t nowMs) {
+    if (current == EXPRESS_DONE) {
+        return EXPRESS_NONE;
+    }
+    if (!pluggedIn) {
+        current = EXPRESS_DONE;
+        return EXPRESS_UNPLUGGED;
+    }
+
+    if (current == EXPRESS_SETTLING) {
+        bool same = true;
+        for (int i = 0; i < 3; i++) {
+            int level = cordWireLevel(measurements, references, i);
+            same &= level == levels[i];
+            levels[i] = level;
+        }
+        if (!same) {
+            stableScans = 0;
+            stableSinceMs = nowMs;
+        }
+        stableScans++;
+        bool settled = stableScans >= EXPRESS_STABLE_SCANS && nowMs - stableSinceMs >= EXPRESS_STABLE_MS;
+        if (!settled && nowMs - startMs <= EXPRESS_TIMEOUT_MS) {
+            return EXPRESS_NONE;
+        }
+        faultBits = cordWireFaults(measurements, references);
+        verdictMs = nowMs;
+        current = EXPRESS_WATCHING;
+        return EXPRESS_VERDICT;
+    }
+
+    // Pulling the plug opens all wires within a scan or two, so a dropout only counts while another wire is still
+    // connected, and on EXPRESS_DROPOUT_SCANS scans in a row
+    bool anyConnected = false;
+    int scanLevels[3];
+    for (int i = 0; i < 3; i++) {
+        scanLevels[i] = cordWireLevel(measurements, references, i);
+        anyConnected |= scanLevels[i] >= 0;
+    }
+    ExpressEvent_t event = EXPRESS_NONE;
+    for (int i = 0; i < 3; i++) {
+        dropouts[i] = anyConnected && scanLevels[i] < 0 ? dropouts[i] + 1 : 0;
+        if (dropouts[i] == EXPRESS_DROPOUT_SCANS && levels[i] >= 0) {
+            levels[i] = -1;
+            faultBits |= wireFaults(i, CORD_FAULT_BROKEN);
+            event = EXPRESS_WIRE_DROPPED;
+        }
+    }
+    return event;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "BatchSession.h"
+#include "TesterStateMachine.h"
+
+constexpr int EXPRESS_STABLE_SCANS = 3;        // Express check: scans in a row that have to agree on every wire,
+constexpr uint32_t EXPRESS_STABLE_MS = 20;     // over at least this long, so contact bounce is over
+constexpr uint32_t EXPRESS_TIMEOUT_MS = 3000;  // Verdict on the latest scan when the readings never settle
+constexpr int EXPRESS_DROPOUT_SCANS = 2;       // Scans in a row a wire has to be gone for after the verdict
+
+// The references a body cord's straight wires are judged by, in mV
+struct CordReferences {
+    int broken;   // ReferenceBroken: a straight wire at or above this is not connected
+    int green;    // At or below: green
+    int yellow;   // At or below: yellow, above: orange
+    int shortMv;  // ReferenceShort: an open wire with a cross entry at or below this is swapped, not broken
+};
+
+// 0, 1 or 2 (green, yellow, orange) for a straight wire that is connected without a short, -1 otherwise.
+// measurements as testWiresOnByOne leaves them, [drive][sense].
+int cordWireLevel(const int measurements[3][3], const CordReferences& references, int wire);
+
+// wireFaults() of every wire without a level: shorted, broken or swapped
+uint16_t cordWireFaults(const int measurements[3][3], const CordReferences& references);
+
+typedef enum { EXPRESS_SETTLING, EXPRESS_WATCHING, EXPRESS_DONE } ExpressPhase_t;
+
+// What a tick changed on the display
+typedef enum { EXPRESS_NONE, EXPRESS_VERDICT, EXPRESS_WIRE_DROPPED, EXPRESS_UNPLUGGED } ExpressEvent_t;
+
+// Express armoury check of a body cord, instead of both wire test phases, one tick per scan. The verdict comes as
+// soon as the three straight wires read the same for EXPRESS_STABLE_SCANS scans over EXPRESS_STABLE_MS; it is one
+// frame, each wire's line in its color, red when it is broken, shorted or swapped. The frame stays until the cord
+// is unplugged; a wire that drops out meanwhile, for EXPRESS_DROPOUT_SCANS scans while another one is still
+// connected, turns red and fails the cord. Pure logic like TesterStateMachine, so it builds on the host.
+class ExpressCordCheck {
+   public:
+    void start(uint32_t nowMs);
+    // One scan: measurements, whether WirePluggedIn(ReferenceBroken) holds on it, and the time it was taken
+    ExpressEvent_t tick(const int measurements[3][3], const CordReferences& references, bool pluggedIn,
+                        uint32_t nowMs);
+
+    ExpressPhase_t phase() const { return current; }
+    int level(int wire) const { return levels[wire]; }  // -1 shows red
+    bool passed() const { return levels[0] >= 0 && levels[1] >= 0 && levels[2] >= 0; }
+    uint16_t faults() const { return faultBits; }
+    uint32_t verdictAtMs() const { return verdictMs; }
+
+   private:
+    ExpressPhase_t current = EXPRESS_DONE;
+    int levels[3] = {-2, -2, -2};
+    int stableScans = 0;
+    uint32_t startMs = 0;
+    uint32_t stableSinceMs = 0;
+    uint32_t verdictMs = 0;
+    int dropouts[3] = {0, 0, 0};
+    uint16_t faultBits = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <limits.h>
+#include <stdint.h>
+
+// Debounced "while" condition. The predicate is a template parameter, so a lambda or functor is stored by value and
+// called directly: no std::function, no heap capture, no indirect call. Feed it the time, and whatever the predicate
+// takes, with every evaluation; it turns false once the predicate has been false for stableMs without interruption,
+// a single true reading restarts that.
+template <typename Predicate>
+class Debouncer {
+   public:
+    Debouncer(Predicate predicate, uint32_t stableMs) : predicate(predicate), stableMs(stableMs) {}
+
+    template <typename... Args>
+    bool holds(uint32_t nowMs, const Args&... args) {
+        if (predicate(args...)) {
+            timing = false;
+            return true;
+        }
+        if (!timing) {
+            falseSinceMs = nowMs;
+            timing = true;
+        }
+        return nowMs - falseSinceMs < stableMs;
+    }
+
+   private:
+    Predicate predicate;
+    uint32_t stableMs;
+    uint32_t falseSinceMs = 0;
+    bool timing = false;
+};
+
+// A band [low, high) with hysteresis: a value that was inside only counts as outside when it is more than margin
+// beyond an edge.
+class HysteresisBand {
+   public:
+    HysteresisBand(int low, int high, int margin)
+        : lowEdge(low == INT_MIN ? INT_MIN : low - margin), highEdge(high == INT_MAX ? INT_MAX : high + margin) {}
+
+    // Band `band` of ascending `thresholds`: 0 below the first, count at or above the last
+    HysteresisBand(const int* thresholds, int count, int band, int margin)
+        : HysteresisBand(band > 0 ? thresholds[band - 1] : INT_MIN, band < count ? thresholds[band] : INT_MAX,
+                         margin) {}
+
+    bool contains(int value) const { return value >= lowEdge && value < highEdge; }
+    // As a Debouncer predicate: debounced "still inside"
+    bool operator()(int value) const { return contains(value); }
+
+   private:
+    int lowEdge;
+    int highEdge;
+};
@@ -0,0 +1,423 @@
+#include "MeasurementBenchmarks.h"
+
+#include <Arduino.h>
+
+#include "AdcStream.h"
+#include "RobustEstimator.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "resitancemeasurement.h"
+
+namespace {
+
+constexpr int BENCH_ROUNDS = 200;
+constexpr int ADC_BENCH_READS = 200;
+constexpr int SCAN_BENCH_ROUNDS = 20;
+constexpr int ESTIMATOR_BENCH_ROUNDS = 500;
+constexpr int MUX_CONNECTED_MV = 160;  // WirePluggedIn default, what decides "connected" for the matrix
+
+// The 9 patterns of a full scan, in raw IODirection/IOValues form for the pinMode based reference
+const uint8_t scanSettings[9][2] = {
+    {IODirection_cr_cl, IOValues_cr_cl}, {IODirection_cr_piste, IOValues_cr_piste}, {IODirection_cr_bl, IOValues_cr_bl},
+    {IODirection_ar_cl, IOValues_ar_cl}, {IODirection_ar_piste, IOValues_ar_piste}, {IODirection_ar_bl, IOValues_ar_bl},
+    {IODirection_br_cl, IOValues_br_cl}, {IODirection_br_piste, IOValues_br_piste}, {IODirection_br_bl, IOValues_br_bl}};
+
+void printCycles(ITerminal* term, const char* label, uint32_t cycles, int count) {
+    uint32_t perCall = cycles / count;
+    term->printf("  %-28s: %6lu cycles/switch (%lu ns)\n", label, (unsigned long)perCall,
+                 (unsigned long)(perCall * 1000 / getCpuFrequencyMhz()));
+}
+
+// Raw conversion rate of one pair, plus the time of a complete 3x3 scan on top of it
+void reportAdcThroughput(ITerminal* term, const char* label) {
+    applyDrivePattern(PAIR_AR_BR);
+    int conversions = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < ADC_BENCH_READS; i++) {
+        conversions += 2 * acquireSamples(ar_analog, br_analog, NUM_ADC_SAMPLES);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    int64_t scanStart = esp_timer_get_time();
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        testWiresOnByOne();
+    }
+    int64_t scanElapsed = esp_timer_get_time() - scanStart;
+
+    term->printf("  %-22s: %7lu samples/s, full scan %lu us\n", label,
+                 (unsigned long)(elapsed > 0 ? conversions * 1000000LL / elapsed : 0),
+                 (unsigned long)(scanElapsed / SCAN_BENCH_ROUNDS));
+}
+
+// The former getDifferentialSample kernel: insertion sort of channel 1, channel 2 carried along
+int legacyTrimmedMean(int* samples1, int* samples2, int nr_samples) {
+    for (int i = 1; i < nr_samples; i++) {
+        int key1 = samples1[i];
+        int key2 = samples2[i];
+        int j = i - 1;
+        while (j >= 0 && samples1[j] > key1) {
+            samples1[j + 1] = samples1[j];
+            samples2[j + 1] = samples2[j];
+            j--;
+        }
+        samples1[j + 1] = key1;
+        samples2[j + 1] = key2;
+    }
+    int trim_count = RobustEstimator<MAX_NUM_ADC_SAMPLES>::trimFor(nr_samples);
+    long sum1 = 0, sum2 = 0;
+    for (int i = trim_count; i < nr_samples - trim_count; i++) {
+        sum1 += samples1[i];
+        sum2 += samples2[i];
+    }
+    return (sum1 - sum2) / (nr_samples - 2 * trim_count);
+}
+
+// Noisy readings around two levels with occasional spikes, like a real differential pair
+void fillSyntheticSamples(int* samples1, int* samples2, int nr_samples, uint32_t& seed) {
+    for (int i = 0; i < nr_samples; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        int noise1 = (int)((seed >> 16) & 31) - 16;
+        int noise2 = (int)((seed >> 8) & 31) - 16;
+        int spike = ((seed >> 24) & 15) == 0 ? 400 : 0;
+        samples1[i] = 2100 + noise1 + spike;
+        samples2[i] = 1900 + noise2;
+    }
+}
+
+template <int N>
+void reportEstimators(ITerminal* term) {
+    int input1[N], input2[N], work1[N], work2[N];
+    uint32_t seed = 12345;
+    uint32_t legacyCycles = 0, trimmedCycles = 0, medianCycles = 0, momCycles = 0;
+    volatile int sink = 0;
+
+    for (int r = 0; r < ESTIMATOR_BENCH_ROUNDS; r++) {
+        fillSyntheticSamples(input1, input2, N, seed);
+        // The legacy kernel sorts in place, give it a fresh copy every round
+        std::copy(input1, input1 + N, work1);
+        std::copy(input2, input2 + N, work2);
+
+        uint32_t start = ESP.getCycleCount();
+        sink = legacyTrimmedMean(work1, work2, N);
+        legacyCycles += ESP.getCycleCount() - start;
+
+        start = ESP.getCycleCount();
+        sink = RobustEstimator<N>::trimmedMean(input1) - RobustEstimator<N>::trimmedMean(input2);
+        trimmedCycles += ESP.getCycleCount() - start;
+
+        start = ESP.getCycleCount();
+        sink = RobustEstimator<N>::median(input1) - RobustEstimator<N>::median(input2);
+        medianCycles += ESP.getCycleCount() - start;
+
+        start = ESP.getCycleCount();
+        sink = RobustEstimator<N>::template medianOfMeans<4>(input1) -
+               RobustEstimator<N>::template medianOfMeans<4>(input2);
+        momCycles += ESP.getCycleCount() - start;
+    }
+    (void)sink;
+
+    term->printf("%d samples per channel, cycles per differential estimate:\n", N);
+    term->printf("  insertion sort (legacy) : %6lu\n", (unsigned long)(legacyCycles / ESTIMATOR_BENCH_ROUNDS));
+    term->printf("  trimmed mean            : %6lu\n", (unsigned long)(trimmedCycles / ESTIMATOR_BENCH_ROUNDS));
+    term->printf("  median                  : %6lu\n", (unsigned long)(medianCycles / ESTIMATOR_BENCH_ROUNDS));
+    term->printf("  median of 4 means       : %6lu\n", (unsigned long)(momCycles / ESTIMATOR_BENCH_ROUNDS));
+}
+
+// Full scans with the current sampling mode, on whatever is plugged in
+void reportScanSampling(ITerminal* term, const char* label) {
+    resetSamplingStats();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        testWiresOnByOne();
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    term->printf("  %-8s: full scan %6lu us, %5.1f samples/pair\n", label,
+                 (unsigned long)(elapsed / SCAN_BENCH_ROUNDS), getAverageSamplesPerPair());
+}
+
+// Time of one scheduled scan, averaged over enough scans to cycle through the cold entries
+void reportScanSchedule(ITerminal* term, const char* label, const ScanSchedule& schedule) {
+    setScanSchedule(schedule);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        scanScheduled();
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    term->printf("  %-8s: %6lu us/scan\n", label, (unsigned long)(elapsed / SCAN_BENCH_ROUNDS));
+}
+
+// Time and noise of a full per-pair scan in the given order. The noise is the standard deviation of each
+// matrix entry over the rounds, averaged over the entries: residual settling shows up there, not in the time.
+void reportScanOrder(ITerminal* term, const char* label, const Pair_t* order) {
+    float sum[3][3] = {};
+    float sumSquares[3][3] = {};
+    setScanOrder(order);
+    int64_t elapsed = 0;
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        testAlBl();  // The pattern the waiting loop leaves the drivers in
+        int64_t start = esp_timer_get_time();
+        testWiresOnByOne();
+        elapsed += esp_timer_get_time() - start;
+        for (int Nr = 0; Nr < 3; Nr++) {
+            for (int j = 0; j < 3; j++) {
+                sum[Nr][j] += measurements[Nr][j];
+                sumSquares[Nr][j] += (float)measurements[Nr][j] * measurements[Nr][j];
+            }
+        }
+    }
+    float noise = 0.0f;
+    for (int Nr = 0; Nr < 3; Nr++) {
+        for (int j = 0; j < 3; j++) {
+            float mean = sum[Nr][j] / SCAN_BENCH_ROUNDS;
+            float variance = sumSquares[Nr][j] / SCAN_BENCH_ROUNDS - mean * mean;
+            noise += variance > 0 ? sqrtf(variance) : 0.0f;
+        }
+    }
+    term->printf("  %-14s: %6lu us/scan, noise %5.1f mV\n", label, (unsigned long)(elapsed / SCAN_BENCH_ROUNDS),
+                 noise / 9);
+}
+
+// A lame top decision that falls through to red, as the blocking lame top loop made it: CrCl three times in a row
+void reportCachedDecision(ITerminal* term, const char* label, int maxAgeUs) {
+    setMeasurementCacheMaxAge(maxAgeUs);
+    int64_t elapsed = 0;
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        invalidateMeasurementCache();  // Every iteration starts without cached readings
+        int64_t start = esp_timer_get_time();
+        testCrCl();
+        testCrCl();
+        testCrCl();
+        elapsed += esp_timer_get_time() - start;
+    }
+    term->printf("  %-12s: %6lu us/iteration\n", label, (unsigned long)(elapsed / BENCH_ROUNDS));
+}
+
+// Mean samples and spread of repeated readings of each wire pair, with the current range setting. The spread is
+// the standard deviation of the reading over the rounds, what the sample count has to keep down.
+void reportRangeNoise(ITerminal* term, const char* label, float* spread) {
+    term->printf("  %-8s:", label);
+    for (int pair = PAIR_CR_CL; pair <= PAIR_BR_BL; pair++) {
+        float sum = 0.0f;
+        float sumSquares = 0.0f;
+        resetSamplingStats();
+        for (int i = 0; i < BENCH_ROUNDS; i++) {
+            esp_task_wdt_reset();
+            int value = measurePair((Pair_t)pair, NUM_ADC_SAMPLES).mean;
+            sum += value;
+            sumSquares += (float)value * value;
+        }
+        float mean = sum / BENCH_ROUNDS;
+        float variance = sumSquares / BENCH_ROUNDS - mean * mean;
+        spread[pair] = variance > 0 ? sqrtf(variance) : 0.0f;
+        term->printf(" %4.1f/%4.1f", getAverageSamplesPerPair(), spread[pair]);
+    }
+    term->printf("\n");
+}
+
+}  // namespace
+
+void benchmarkDrivePatterns(ITerminal* term) {
+    uint32_t legacyCycles = 0;
+    uint32_t runtimeCycles = 0;
+    uint32_t tableCycles = 0;
+
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        esp_task_wdt_reset();
+        for (int p = 0; p < 9; p++) {
+            uint32_t start = ESP.getCycleCount();
+            Set_IODirectionAndValueLegacy(scanSettings[p][0], scanSettings[p][1]);
+            legacyCycles += ESP.getCycleCount() - start;
+
+            start = ESP.getCycleCount();
+            Set_IODirectionAndValue(scanSettings[p][0], scanSettings[p][1]);
+            runtimeCycles += ESP.getCycleCount() - start;
+
+            start = ESP.getCycleCount();
+            applyDrivePattern((Pair_t)p);
+            tableCycles += ESP.getCycleCount() - start;
+        }
+    }
+
+    term->printf("Drive pattern switch, %d switches each:\n", BENCH_ROUNDS * 9);
+    printCycles(term, "pinMode/digitalWrite", legacyCycles, BENCH_ROUNDS * 9);
+    printCycles(term, "register, masks at runtime", runtimeCycles, BENCH_ROUNDS * 9);
+    printCycles(term, "register, precomputed table", tableCycles, BENCH_ROUNDS * 9);
+}
+
+void benchmarkAdcThroughput(ITerminal* term) {
+    bool streamWasRunning = adcStream().isRunning();
+
+    term->printf("ADC throughput, %d reads of %d sample pairs:\n", ADC_BENCH_READS, NUM_ADC_SAMPLES);
+    adcStream().end();
+    reportAdcThroughput(term, "adc1_get_raw polling");
+    if (adcStream().begin()) {
+        reportAdcThroughput(term, "DMA stream");
+    } else {
+        term->printf("  DMA stream could not be started\n");
+    }
+
+    if (!streamWasRunning) {
+        adcStream().end();
+    }
+}
+
+void benchmarkEstimators(ITerminal* term) {
+    esp_task_wdt_reset();
+    reportEstimators<NUM_ADC_SAMPLES>(term);
+    esp_task_wdt_reset();
+    reportEstimators<MAX_NUM_ADC_SAMPLES>(term);
+}
+
+void benchmarkAdaptiveSampling(ITerminal* term) {
+    bool wasAdaptive = isAdaptiveSampling();
+
+    term->printf("Sampling, %d full scans of %d pairs, budget %d samples:\n", SCAN_BENCH_ROUNDS, 9, NUM_ADC_SAMPLES);
+    setAdaptiveSampling(false);
+    reportScanSampling(term, "fixed");
+    setAdaptiveSampling(true);
+    reportScanSampling(term, "adaptive");
+    term->printf("  (adaptive falls back to fixed until the tester has set its thresholds)\n");
+
+    setAdaptiveSampling(wasAdaptive);
+    resetSamplingStats();
+}
+
+void benchmarkScanSchedules(ITerminal* term) {
+    ScanSchedule active = getScanSchedule();
+    term->printf("Scan schedules, %d scans each:\n", SCAN_BENCH_ROUNDS);
+    reportScanSchedule(term, "full", SCAN_FULL);
+    reportScanSchedule(term, "lame", SCAN_LAME);
+    reportScanSchedule(term, "foil", SCAN_FOIL);
+    reportScanSchedule(term, "epee", SCAN_EPEE);
+    reportScanSchedule(term, "lame top", SCAN_LAME_TOP);
+    setScanSchedule(active);
+}
+
+void benchmarkMultiplexedScan(ITerminal* term) {
+    bool wasMultiplexed = isMultiplexedScan();
+    int reference[3][3];
+    long difference[3][3] = {};
+    int mismatches = 0;
+    int64_t perPairUs = 0;
+    int64_t multiplexedUs = 0;
+
+    // Interleave both scans so they see the same wires
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        setMultiplexedScan(false);
+        int64_t start = esp_timer_get_time();
+        testWiresOnByOne();
+        perPairUs += esp_timer_get_time() - start;
+        memcpy(reference, measurements, sizeof(reference));
+
+        setMultiplexedScan(true);
+        start = esp_timer_get_time();
+        testWiresOnByOne();
+        multiplexedUs += esp_timer_get_time() - start;
+
+        for (int Nr = 0; Nr < 3; Nr++) {
+            for (int j = 0; j < 3; j++) {
+                difference[Nr][j] += abs(measurements[Nr][j] - reference[Nr][j]);
+                if ((measurements[Nr][j] < MUX_CONNECTED_MV) != (reference[Nr][j] < MUX_CONNECTED_MV)) {
+                    mismatches++;
+                }
+            }
+        }
+    }
+    setMultiplexedScan(wasMultiplexed);
+
+    term->printf("Multiplexed vs per-pair scan, %d scans each:\n", SCAN_BENCH_ROUNDS);
+    term->printf("  per-pair   : %6lu us/scan, 9 pattern switches\n", (unsigned long)(perPairUs / SCAN_BENCH_ROUNDS));
+    term->printf("  multiplexed: %6lu us/scan, 3 pattern switches (more for rows with several connections)\n",
+                 (unsigned long)(multiplexedUs / SCAN_BENCH_ROUNDS));
+    term->printf("  mean |difference| in mV, rows cr/ar/br, columns cl/piste/bl:\n");
+    for (int Nr = 0; Nr < 3; Nr++) {
+        term->printf("    %5ld %5ld %5ld\n", difference[Nr][0] / SCAN_BENCH_ROUNDS,
+                     difference[Nr][1] / SCAN_BENCH_ROUNDS, difference[Nr][2] / SCAN_BENCH_ROUNDS);
+    }
+    term->printf("  connected/open disagreements (< %d mV): %d\n", MUX_CONNECTED_MV, mismatches);
+}
+
+void benchmarkScanOrder(ITerminal* term) {
+    bool wasMultiplexed = isMultiplexedScan();
+    setMultiplexedScan(false);
+
+    term->printf("Scan order, %d per-pair full scans each:\n", SCAN_BENCH_ROUNDS);
+    reportScanOrder(term, "row major", SCAN_ORDER_ROW_MAJOR);
+    reportScanOrder(term, "min switching", SCAN_ORDER_MIN_SWITCHING);
+
+    setScanOrder(SCAN_ORDER_MIN_SWITCHING);
+    setMultiplexedScan(wasMultiplexed);
+}
+
+void benchmarkPresenceProbe(ITerminal* term) {
+    int64_t fullElapsed = 0;
+    int64_t probeElapsed = 0;
+    int changes = 0;
+    for (int i = 0; i < SCAN_BENCH_ROUNDS; i++) {
+        esp_task_wdt_reset();
+        // What the waiting loop does every iteration without the probe
+        int64_t start = esp_timer_get_time();
+        testWiresOnByOne();
+        testCrossPairs();
+        fullElapsed += esp_timer_get_time() - start;
+
+        start = esp_timer_get_time();
+        changes += presenceChanged(60000) ? 1 : 0;
+        probeElapsed += esp_timer_get_time() - start;
+    }
+    resetPresenceProbe();
+
+    term->printf("Waiting loop, %d iterations each:\n", SCAN_BENCH_ROUNDS);
+    term->printf("  %-14s: %6lu us/iteration\n", "full pass", (unsigned long)(fullElapsed / SCAN_BENCH_ROUNDS));
+    term->printf("  %-14s: %6lu us/iteration, %d changes seen\n", "presence probe",
+                 (unsigned long)(probeElapsed / SCAN_BENCH_ROUNDS), changes);
+    term->printf("  (the first probe always reports a change, plug something in during the run to see more)\n");
+}
+
+void benchmarkMeasurementCache(ITerminal* term) {
+    int maxAgeUs = getMeasurementCacheMaxAge();
+
+    term->printf("Lame top decision, %d iterations each:\n", BENCH_ROUNDS);
+    reportCachedDecision(term, "no cache", 0);
+    reportCachedDecision(term, "cache 2 ms", 2000);
+
+    setMeasurementCacheMaxAge(maxAgeUs);
+    invalidateMeasurementCache();
+}
+
+void benchmarkAutoRange(ITerminal* term) {
+    bool wasAutoRanging = isAutoRanging();
+    bool wasAdaptive = isAdaptiveSampling();
+    int mainsFrequency = getMainsFrequency();
+    float fullRange[NUM_PAIRS] = {};
+    float autoRange[NUM_PAIRS] = {};
+
+    // Only the range may differ between the two runs
+    setAdaptiveSampling(false);
+    setMainsFrequency(0);
+    term->printf("Auto-ranging, %d readings of each wire pair, budget %d samples:\n", BENCH_ROUNDS, NUM_ADC_SAMPLES);
+    term->printf("  samples/spread in mV, pairs cr, ar, br against cl, piste, bl\n");
+    setAutoRanging(false);
+    reportRangeNoise(term, "11 dB", fullRange);
+    setAutoRanging(true);
+    reportRangeNoise(term, "auto", autoRange);
+    int worse = 0;
+    for (int pair = PAIR_CR_CL; pair <= PAIR_BR_BL; pair++) {
+        if (autoRange[pair] > fullRange[pair] * 1.1f + 0.5f) {
+            worse++;
+        }
+    }
+    term->printf("  pairs noticeably noisier with auto-ranging: %d (connect a cord, open pairs stay at 11 dB)\n",
+                 worse);
+
+    setAutoRanging(wasAutoRanging);
+    setAdaptiveSampling(wasAdaptive);
+    setMainsFrequency(mainsFrequency);
+    resetSamplingStats();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ITerminal.h"
+
+// On-target micro benchmarks for the measurement layer, started with the "bench" terminal command.
+// They drive the same pins and ADC channels as the tester, so they run in the tester task (runInTesterTask).
+void benchmarkDrivePatterns(ITerminal* term);
+void benchmarkAdcThroughput(ITerminal* term);
+void benchmarkEstimators(ITerminal* term);
+void benchmarkAdaptiveSampling(ITerminal* term);
+void benchmarkScanSchedules(ITerminal* term);
+void benchmarkMultiplexedScan(ITerminal* term);
+void benchmarkScanOrder(ITerminal* term);
+void benchmarkPresenceProbe(ITerminal* term);
+void benchmarkMeasurementCache(ITerminal* term);
+void benchmarkAutoRange(ITerminal* term);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// Every measurement the tester performs. The first 9 entries are the [Nr][j] entries of the
+// 3x3 scan (right side cr/ar/br against left side cl/piste/bl), the rest are the cross probes.
+// Kept free of any ESP-IDF include, so host tools can use it.
+typedef enum {
+    PAIR_CR_CL,
+    PAIR_CR_PISTE,
+    PAIR_CR_BL,
+    PAIR_AR_CL,
+    PAIR_AR_PISTE,
+    PAIR_AR_BL,
+    PAIR_BR_CL,
+    PAIR_BR_PISTE,
+    PAIR_BR_BL,
+    PAIR_AR_BR,
+    PAIR_AR_CR,
+    PAIR_BR_CR,
+    PAIR_CL_PISTE,
+    NUM_PAIRS
+} Pair_t;
+
+// Partial scans of the 3x3 matrix. Bit Nr*3+j of a mask stands for measurements[Nr][j] (the Pair_t order).
+// Hot entries are measured on every scan, coldPerScan of the cold entries round-robin, the rest not at all.
+struct ScanSchedule {
+    uint16_t hotMask;
+    uint16_t coldMask;
+    uint8_t coldPerScan;
+};
+
+constexpr uint16_t scanBit(int Nr, int j) { return 1 << (Nr * 3 + j); }
+constexpr uint16_t SCAN_ALL = 0x1FF;
+constexpr uint16_t SCAN_STRAIGHT = scanBit(0, 0) | scanBit(1, 1) | scanBit(2, 2);
+
+// Each schedule covers exactly the entries the matching WirePluggedIn variant looks at. Plugging in a
+// body wire shows up on the straight entries first, so those are hot.
+constexpr ScanSchedule SCAN_FULL = {SCAN_ALL, 0, 0};
+constexpr ScanSchedule SCAN_LAME = {SCAN_STRAIGHT, SCAN_ALL & ~SCAN_STRAIGHT, 1};
+constexpr ScanSchedule SCAN_FOIL = {SCAN_STRAIGHT, SCAN_ALL & ~SCAN_STRAIGHT & ~scanBit(1, 0) & ~scanBit(2, 0), 1};
+constexpr ScanSchedule SCAN_EPEE = {scanBit(1, 1) | scanBit(2, 2),
+                                    scanBit(0, 1) | scanBit(0, 2) | scanBit(1, 2) | scanBit(2, 1), 1};
+constexpr ScanSchedule SCAN_LAME_TOP = {scanBit(1, 1) | scanBit(2, 2),
+                                        scanBit(1, 0) | scanBit(1, 2) | scanBit(2, 0) | scanBit(2, 1), 1};
@@ -0,0 +1,55 @@
+#include "MeasurementSnapshot.h"
+
+#include "esp_timer.h"
+
+MeasurementSnapshot& MeasurementSnapshot::getInstance() {
+    static MeasurementSnapshot instance;
+    return instance;
+}
+
+MeasurementSnapshot::MeasurementSnapshot() : latest(-1), sequence(0) {
+    for (int i = 0; i < 2; i++) {
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void MeasurementSnapshot::publish(const int values[3][3]) {
+    // Write the slot readers are not directed to
+    int index = latest.load(std::memory_order_relaxed) == 0 ? 1 : 0;
+    Slot& slot = slots[index];
+
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int Nr = 0; Nr < 3; Nr++) {
+        for (int j = 0; j < 3; j++) {
+            slot.frame.values[Nr][j] = values[Nr][j];
+        }
+    }
+    slot.frame.timestampUs = esp_timer_get_time();
+    slot.frame.sequence = ++sequence;
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    latest.store(index, std::memory_order_release);
+}
+
+bool MeasurementSnapshot::read(MeasurementFrame& frame) const {
+    while (true) {
+        int index = latest.load(std::memory_order_acquire);
+        if (index < 0) {
+            return false;
+        }
+        const Slot& slot = slots[index];
+
+        uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;  // Writer is lapping us, the other slot is complete by now
+        }
+        frame = slot.frame;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <atomic>
+
+// One complete scan of the 3x3 matrix
+struct MeasurementFrame {
+    int values[3][3];
+    int64_t timestampUs;  // esp_timer time at the end of the scan
+    uint32_t sequence;    // Scan counter, increments by one per published frame
+};
+
+// Latest measurement frame, shared between the tester task and any reader (terminals, telemetry).
+// The writer alternates between two buffers, each guarded by its own sequence counter (seqlock):
+// publishing never waits, and a reader only retries when the writer lapped it while it was copying.
+class MeasurementSnapshot {
+   private:
+    struct Slot {
+        std::atomic<uint32_t> seq;  // Odd while the slot is being written
+        MeasurementFrame frame;
+    };
+    Slot slots[2];
+    std::atomic<int> latest;  // Slot holding the most recent complete frame, -1 before the first one
+    uint32_t sequence;        // Only touched by the writer
+
+    MeasurementSnapshot();
+    MeasurementSnapshot(const MeasurementSnapshot&) = delete;
+    MeasurementSnapshot& operator=(const MeasurementSnapshot&) = delete;
+
+   public:
+    static MeasurementSnapshot& getInstance();
+
+    // Writer side, single producer only
+    void publish(const int values[3][3]);
+
+    // Copies the latest frame into `frame`. Returns false if nothing was published yet.
+    bool read(MeasurementFrame& frame) const;
+};
+
+inline MeasurementSnapshot& measurementSnapshot() { return MeasurementSnapshot::getInstance(); }
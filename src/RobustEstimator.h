@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+
+// Allocation-free robust location estimators for one channel of ADC samples.
+// N is the (maximum) number of samples and sizes the work buffer on the stack; `count` can be lower when
+// an acquisition delivered fewer samples. All kernels use selection (std::nth_element, linear on average)
+// on a copy of the samples instead of sorting them, so the input is left untouched.
+template <int N>
+class RobustEstimator {
+    static_assert(N > 0, "RobustEstimator needs at least one sample");
+
+   public:
+    // Samples dropped at each end: 10%, at least 1, none for very small counts
+    static constexpr int trimFor(int count) { return count <= 4 ? 0 : (count / 10 < 1 ? 1 : count / 10); }
+
+    // Mean of the samples that remain after dropping `trim` smallest and `trim` largest values
+    static int trimmedMean(const int* samples, int count, int trim) {
+        int work[N];
+        count = clampCount(count);
+        if (count == 0) {
+            return 0;
+        }
+        std::copy(samples, samples + count, work);
+        if (trim < 0 || 2 * trim >= count) {
+            trim = 0;
+        }
+        if (trim > 0) {
+            // Smallest `trim` values end up in front, then the largest `trim` at the back
+            std::nth_element(work, work + trim, work + count);
+            std::nth_element(work + trim, work + count - trim, work + count);
+        }
+        long sum = 0;
+        for (int i = trim; i < count - trim; i++) {
+            sum += work[i];
+        }
+        return sum / (count - 2 * trim);
+    }
+
+    static int trimmedMean(const int* samples, int count = N) { return trimmedMean(samples, count, trimFor(count)); }
+
+    static int median(const int* samples, int count = N) {
+        int work[N];
+        count = clampCount(count);
+        if (count == 0) {
+            return 0;
+        }
+        std::copy(samples, samples + count, work);
+        return medianInPlace(work, count);
+    }
+
+    // Median of the means of GROUPS consecutive blocks. Robust against bursts that hit a single block.
+    template <int GROUPS>
+    static int medianOfMeans(const int* samples, int count = N) {
+        static_assert(GROUPS > 0 && GROUPS <= N, "Invalid number of groups");
+        int means[GROUPS];
+        count = clampCount(count);
+        int groupSize = count / GROUPS;
+        if (groupSize == 0) {
+            return median(samples, count);
+        }
+        for (int g = 0; g < GROUPS; g++) {
+            long sum = 0;
+            for (int i = g * groupSize; i < (g + 1) * groupSize; i++) {
+                sum += samples[i];
+            }
+            means[g] = sum / groupSize;
+        }
+        return medianInPlace(means, GROUPS);
+    }
+
+   private:
+    static int clampCount(int count) { return count < 0 ? 0 : (count > N ? N : count); }
+
+    // Reorders work[0..count)
+    static int medianInPlace(int* work, int count) {
+        int half = count / 2;
+        std::nth_element(work, work + half, work + count);
+        if (count % 2) {
+            return work[half];
+        }
+        // Lower middle value is the largest of the front half
+        int lower = *std::max_element(work, work + half);
+        return (lower + work[half]) / 2;
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <math.h>
+
+// Scalar Kalman filter for a quantity that is constant most of the time and occasionally jumps, such as the
+// resistance of a pair while a lame is being tested. Small innovations are averaged in with the Kalman gain;
+// an innovation well outside the expected spread is taken as a step and restarts the filter on the new value.
+class ScalarKalman {
+   public:
+    ScalarKalman() : q(0.0f), r(1.0f), stepSigmas(4.0f), stepMin(0.0f), estimate(0.0f), variance(0.0f), valid(false) {}
+
+    // processNoise: expected drift per update, measurementNoise: spread of one measurement (both one sigma).
+    // A step has to exceed both `sigmas` times the predicted spread and `minimum`.
+    void configure(float processNoise, float measurementNoise, float sigmas, float minimum) {
+        q = processNoise * processNoise;
+        r = measurementNoise * measurementNoise;
+        stepSigmas = sigmas;
+        stepMin = minimum;
+        valid = false;
+    }
+
+    void reset() { valid = false; }
+    bool isValid() const { return valid; }
+    float value() const { return estimate; }
+
+    // Returns true when the measurement was taken as a step
+    bool update(float measurement) {
+        if (!valid) {
+            restart(measurement);
+            return true;
+        }
+        variance += q;
+        float innovation = measurement - estimate;
+        float limit = stepSigmas * sqrtf(variance + r);
+        if (fabsf(innovation) > limit && fabsf(innovation) > stepMin) {
+            restart(measurement);
+            return true;
+        }
+        float gain = variance / (variance + r);
+        estimate += gain * innovation;
+        variance *= (1.0f - gain);
+        return false;
+    }
+
+   private:
+    float q;
+    float r;
+    float stepSigmas;
+    float stepMin;
+    float estimate;
+    float variance;
+    bool valid;
+
+    void restart(float measurement) {
+        estimate = measurement;
+        variance = r;
+        valid = true;
+    }
+};
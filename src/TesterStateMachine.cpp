@@ -0,0 +1,246 @@
+#include "TesterStateMachine.h"
+
+namespace {
+
+constexpr uint16_t pairBit(Pair_t pair) { return 1 << pair; }
+
+constexpr uint16_t ALL_WIRES = 0x1FF;
+// The WirePluggedIn* variants as pair masks
+constexpr uint16_t EPEE_EXIT = ALL_WIRES & ~(pairBit(PAIR_CR_CL) | pairBit(PAIR_AR_CL) | pairBit(PAIR_BR_CL));
+constexpr uint16_t FOIL_EXIT = ALL_WIRES & ~(pairBit(PAIR_AR_CL) | pairBit(PAIR_BR_CL));
+constexpr uint16_t LAME_TOP_EXIT = ALL_WIRES & ~(pairBit(PAIR_CR_CL) | pairBit(PAIR_CR_PISTE) | pairBit(PAIR_CR_BL));
+
+constexpr uint16_t EPEE_READS = pairBit(PAIR_BR_CL) | pairBit(PAIR_AR_CL) | pairBit(PAIR_AR_BR) | pairBit(PAIR_BR_CR) |
+                                pairBit(PAIR_AR_CR);
+constexpr uint16_t FOIL_READS = pairBit(PAIR_BR_CL) | pairBit(PAIR_AR_BR) | pairBit(PAIR_AR_CL);
+
+const DisplayColor_t levelColors[4] = {COLOR_GREEN, COLOR_YELLOW, COLOR_ORANGE, COLOR_WHITE};
+
+// One row of the mode decision table: `pair` below `threshold` selects `mode`, provided the 3x3 entries in
+// openMask are open. The first matching row wins. Lame top (CrCl) needs ArPiste and BrBl open, otherwise it is a
+// body cord.
+struct ModeRule {
+    DetectedMode_t mode;
+    Pair_t pair;
+    int TesterThresholds::*threshold;
+    uint16_t openMask;
+};
+
+const ModeRule modeRules[] = {
+    {MODE_EPEE, PAIR_AR_CR, &TesterThresholds::ohm20, 0},
+    {MODE_FOIL, PAIR_AR_BR, &TesterThresholds::ohm20, 0},
+    {MODE_LAME, PAIR_BR_CR, &TesterThresholds::ohm20, 0},
+    {MODE_LAME_TOP, PAIR_CR_CL, &TesterThresholds::ohm20, scanBit(1, 1) | scanBit(2, 2)},
+    {MODE_REEL, PAIR_CL_PISTE, &TesterThresholds::ohm50, 0},
+};
+
+int band(int value, const int* bands, int count) {
+    int b = 0;
+    while (b < count && value >= bands[b]) {
+        b++;
+    }
+    return b;
+}
+
+}  // namespace
+
+DetectedMode_t classifyFrame(const TesterFrame& frame, const TesterThresholds& thresholds, int brokenMv) {
+    for (const ModeRule& rule : modeRules) {
+        if (frame.pairs[rule.pair] >= thresholds.*rule.threshold) {
+            continue;
+        }
+        bool open = true;
+        for (int p = 0; p < 9 && open; p++) {
+            open = !((rule.openMask >> p) & 1) || frame.pairs[p] > CONNECTED_MV;
+        }
+        if (open) {
+            return rule.mode;
+        }
+    }
+    for (int p = 0; p < 9; p++) {
+        if (frame.pairs[p] < brokenMv) {
+            return MODE_BODY_CORD;
+        }
+    }
+    return MODE_NONE;
+}
+
+const TesterStateMachine::ModeHandler TesterStateMachine::handlers[] = {
+    {MODE_EPEE, EPEE_EXIT, EPEE_READS, false, &TesterStateMachine::runEpee},
+    {MODE_FOIL, FOIL_EXIT, FOIL_READS, false, &TesterStateMachine::runFoil},
+    {MODE_LAME, ALL_WIRES, pairBit(PAIR_BR_CR), false, &TesterStateMachine::runLame},
+    {MODE_LAME_TOP, LAME_TOP_EXIT, pairBit(PAIR_CR_CL), false, &TesterStateMachine::runLameTop},
+    {MODE_REEL, EPEE_EXIT, 0, true, &TesterStateMachine::runReel},
+};
+
+bool TesterStateMachine::enter(DetectedMode_t mode, uint32_t nowMs) {
+    for (const ModeHandler& row : handlers) {
+        if (row.mode == mode) {
+            handler = &row;
+            current = mode;
+            shownShape = SHAPE_NONE;
+            holdUntilMs = nowMs;
+            clearAfterHold = false;
+            openFrames = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+int TesterStateMachine::tick(const TesterFrame& frame, DisplayCommand* commands) {
+    out = commands;
+    count = 0;
+    if (handler == nullptr) {
+        return 0;
+    }
+    int exitThreshold = handler->exitAtOhm50 ? thresholds.ohm50 : CONNECTED_MV;
+    for (int p = 0; p < NUM_PAIRS; p++) {
+        if ((handler->exitPairs & pairBit((Pair_t)p)) && frame.pairs[p] < exitThreshold) {
+            clear();
+            handler = nullptr;
+            current = MODE_NONE;
+            return count;
+        }
+    }
+    if ((int32_t)(frame.timeMs - holdUntilMs) < 0) {
+        return 0;
+    }
+    (this->*handler->run)(frame);
+    return count;
+}
+
+void TesterStateMachine::emit(DisplayOp_t op, Shapes_t shape, DisplayColor_t color) {
+    if (count < MAX_DISPLAY_COMMANDS) {
+        out[count++] = {op, shape, color};
+    }
+}
+
+void TesterStateMachine::clear() {
+    emit(DISPLAY_CLEAR);
+    shownShape = SHAPE_NONE;
+}
+
+void TesterStateMachine::show(Shapes_t shape, DisplayColor_t color) {
+    if (shape == shownShape && color == shownColor) {
+        return;
+    }
+    if (shape != shownShape) {
+        clear();
+    }
+    emit(DISPLAY_SHAPE, shape, color);
+    shownShape = shape;
+    shownColor = color;
+}
+
+void TesterStateMachine::showInner9(DisplayColor_t color) {
+    if (shownShape == SHAPE_SQUARE && color == shownColor) {
+        return;
+    }
+    if (shownShape != SHAPE_SQUARE) {
+        clear();
+    }
+    emit(DISPLAY_INNER9, SHAPE_SQUARE, color);
+    shownShape = SHAPE_SQUARE;
+    shownColor = color;
+}
+
+void TesterStateMachine::runEpee(const TesterFrame& frame) {
+    const int probeBands[] = {thresholds.ohm[5], thresholds.ohm[8], PROBE_OPEN_MV};
+    const int singleWireBands[] = {thresholds.ohm[1], thresholds.ohm[2], thresholds.ohm[10], WIRE_OPEN_MV};
+    const int returnWireBands[] = {thresholds.ohm[2], thresholds.ohm[4], WIRE_OPEN_MV};
+
+    int brCl = band(frame.pairs[PAIR_BR_CL], probeBands, 3);
+    if (brCl < 3) {
+        const DisplayColor_t probeColors[] = {COLOR_GREEN, COLOR_YELLOW, COLOR_RED};
+        show(SHAPE_P, probeColors[brCl]);
+        hold(frame, 100);
+        return;
+    }
+
+    bool arBrShort = frame.pairs[PAIR_AR_BR] < SHORT_MV;
+    bool brCrShort = frame.pairs[PAIR_BR_CR] < SHORT_MV;
+    if (arBrShort || brCrShort) {
+        clear();
+        if (arBrShort) {
+            emit(DISPLAY_ANIMATE_AR_BR);
+        }
+        if (brCrShort) {
+            emit(DISPLAY_ANIMATE_BR_CR);
+        }
+        return;
+    }
+
+    // ArCl open: no contact between tip and probe, so the return wire (ArCr) is measured, else the single wire
+    int arCl = band(frame.pairs[PAIR_AR_CL], singleWireBands, 4);
+    int level = arCl == 4 ? band(frame.pairs[PAIR_AR_CR], returnWireBands, 3) : arCl;
+    if (level > 2) {
+        show(SHAPE_E, COLOR_WHITE);
+        return;
+    }
+    showInner9(levelColors[level]);
+    hold(frame, 1000);
+}
+
+void TesterStateMachine::runFoil(const TesterFrame& frame) {
+    const int probeBands[] = {thresholds.ohm[5], thresholds.ohm[8], PROBE_OPEN_MV};
+    const int lameBands[] = {thresholds.ohm[2], thresholds.ohm[4], FOIL_LAME_OPEN_MV};
+    const int tipBands[] = {thresholds.ohm[1], thresholds.ohm[2], PROBE_OPEN_MV};
+
+    if (clearAfterHold) {
+        clearAfterHold = false;
+        if (frame.pairs[PAIR_AR_BR] < SHORT_MV) {
+            clear();
+        }
+    }
+
+    int brCl = band(frame.pairs[PAIR_BR_CL], probeBands, 3);
+    if (brCl < 3) {
+        show(SHAPE_P, levelColors[brCl]);
+        hold(frame, 100);
+        return;
+    }
+
+    // Blade open (a hit) from FOIL_LAME_OPEN_MV on. Once the debounce runs only a reading at or below SHORT_MV
+    // fails it, readings in between still count as open.
+    int arBr = frame.pairs[PAIR_AR_BR];
+    bool open = openFrames ? arBr > SHORT_MV : arBr >= FOIL_LAME_OPEN_MV;
+    if (!open) {
+        show(SHAPE_F, levelColors[band(arBr, lameBands, 3)]);
+        openFrames = 0;
+        return;
+    }
+
+    // The blade has to stay open for FOIL_DEBOUNCE_MS, or a few frames in a row
+    if (openFrames++ == 0) {
+        openSinceMs = frame.timeMs;
+    }
+    if (openFrames < FOIL_DEBOUNCE_CLEAN_READINGS && frame.timeMs - openSinceMs < FOIL_DEBOUNCE_MS) {
+        return;
+    }
+    openFrames = 0;
+    showInner9(levelColors[band(frame.pairs[PAIR_AR_CL], tipBands, 3)]);
+    hold(frame, 1000);
+    clearAfterHold = true;
+}
+
+void TesterStateMachine::showLameBand(const TesterFrame& frame, Pair_t pair) {
+    const int lameBands[] = {thresholds.ohm[5], thresholds.ohm[10], thresholds.ohm25};
+    const DisplayColor_t lameColors[] = {COLOR_GREEN, COLOR_YELLOW, COLOR_ORANGE, COLOR_RED};
+    int value = frame.pairs[pair];
+    if (shownShape == SHAPE_DIAMOND && lameDebounce.holds(frame.timeMs, value)) {
+        return;
+    }
+    int level = band(value, lameBands, 3);
+    lameDebounce = Debouncer<HysteresisBand>(HysteresisBand(lameBands, 3, level, hysteresisMv), LAME_DEBOUNCE_MS);
+    show(SHAPE_DIAMOND, lameColors[level]);
+    if (level == 3) {
+        hold(frame, 250);
+    }
+}
+
+void TesterStateMachine::runLame(const TesterFrame& frame) { showLameBand(frame, PAIR_BR_CR); }
+
+void TesterStateMachine::runLameTop(const TesterFrame& frame) { showLameBand(frame, PAIR_CR_CL); }
+
+void TesterStateMachine::runReel(const TesterFrame&) { show(SHAPE_R, COLOR_GREEN); }
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Debouncer.h"
+#include "MeasurementPairs.h"
+
+typedef enum { SHAPE_F, SHAPE_E, SHAPE_S, SHAPE_P, SHAPE_DIAMOND, SHAPE_SQUARE, SHAPE_R, SHAPE_NONE } Shapes_t;
+
+// What the waiting loop sees plugged in, decided from one frame of all pairs
+typedef enum { MODE_NONE, MODE_EPEE, MODE_FOIL, MODE_LAME, MODE_LAME_TOP, MODE_REEL, MODE_BODY_CORD } DetectedMode_t;
+
+constexpr int FOIL_DEBOUNCE_CLEAN_READINGS = 3;  // Clean readings that end the foil debounce early
+constexpr uint32_t FOIL_DEBOUNCE_MS = 10;
+constexpr uint32_t LAME_DEBOUNCE_MS = 10;  // A lame reading has to stay out of its color band this long
+
+// One reading of every pair, in mV like measurements[Nr][j], and the time it was taken
+struct TesterFrame {
+    int pairs[NUM_PAIRS];
+    uint32_t timeMs;
+};
+
+// The thresholds the special modes compare against, in mV, as the Tester derives them from its calibration
+struct TesterThresholds {
+    int ohm[11];  // myRefs_Ohm, 0 to 10 Ohm
+    int ohm20;
+    int ohm25;
+    int ohm50;
+};
+
+// The fixed thresholds in mV, the ones that do not follow the calibration
+constexpr int CONNECTED_MV = 160;        // WirePluggedIn default, also the body cord's short reference
+constexpr int CROSS_SHORT_MV = 200;      // A body cord wire with a cross entry at or below this is shorted
+constexpr int REEL_SHORT_MV = 300;       // Short reference of the reel test
+constexpr int PROBE_OPEN_MV = 500;       // Probe (BrCl) and foil tip (ArCl) above this: not touching
+constexpr int WIRE_OPEN_MV = 600;        // Epee single and return wire above this: not connected
+constexpr int SHORT_MV = 1500;           // Cross pairs below this are shorted, the foil blade above it is open
+constexpr int FOIL_LAME_OPEN_MV = 2000;  // Foil blade (ArBr) at or above this shows no color
+constexpr int FIXED_THRESHOLDS_MV[] = {CONNECTED_MV, CROSS_SHORT_MV, REEL_SHORT_MV, PROBE_OPEN_MV, WIRE_OPEN_MV,
+                                       SHORT_MV, FOIL_LAME_OPEN_MV};
+constexpr int NUM_FIXED_THRESHOLDS = sizeof(FIXED_THRESHOLDS_MV) / sizeof(FIXED_THRESHOLDS_MV[0]);
+
+// Mode detection as a table over one frame of all pairs, in the priority order of the former probe chain.
+// Without a matching rule any 3x3 entry below brokenMv is a body cord.
+DetectedMode_t classifyFrame(const TesterFrame& frame, const TesterThresholds& thresholds, int brokenMv);
+
+typedef enum { COLOR_GREEN, COLOR_YELLOW, COLOR_ORANGE, COLOR_RED, COLOR_WHITE } DisplayColor_t;
+
+typedef enum {
+    DISPLAY_CLEAR,
+    DISPLAY_SHAPE,          // shape in color: SHAPE_E, SHAPE_F, SHAPE_P, SHAPE_R or SHAPE_DIAMOND
+    DISPLAY_INNER9,         // The inner 3x3 in color
+    DISPLAY_ANIMATE_AR_BR,  // Short animations
+    DISPLAY_ANIMATE_BR_CR,
+} DisplayOp_t;
+
+struct DisplayCommand {
+    DisplayOp_t op;
+    Shapes_t shape;
+    DisplayColor_t color;
+};
+
+constexpr int MAX_DISPLAY_COMMANDS = 4;  // Per tick
+
+// Non-blocking state machine for the special test modes: epee, foil, lame, lame top and reel.
+// Every tick consumes one frame and returns the display commands for it. Waiting is a deadline against the frame
+// time instead of a loop, so a tick never blocks, a mode is left on the first frame that shows a wire plugged in,
+// and the same frames always give the same commands. Pure logic without ESP-IDF includes, so it builds on the host.
+class TesterStateMachine {
+   public:
+    void setThresholds(const TesterThresholds& values) { thresholds = values; }
+    // Margin a lame reading has to leave its color band by (DebounceHysteresis setting)
+    void setHysteresisMv(int value) { hysteresisMv = value > 0 ? value : 0; }
+
+    // Starts a mode, returns false for the modes it does not handle (none, body cord)
+    bool enter(DetectedMode_t mode, uint32_t nowMs);
+    // Fills commands (room for MAX_DISPLAY_COMMANDS) and returns how many. Once the mode ends the last commands
+    // clear the display and isActive() turns false.
+    int tick(const TesterFrame& frame, DisplayCommand* commands);
+
+    // The pairs the current mode classifies, bit 1 << Pair_t. They have to be fresh in every frame, the other
+    // entries only for the exit check, so the caller can keep those on the mode's scan schedule.
+    uint16_t pairsToRead() const { return handler ? handler->readPairs : 0; }
+    DetectedMode_t mode() const { return current; }
+    bool isActive() const { return current != MODE_NONE; }
+
+   private:
+    // One row per mode: leave when any pair in exitPairs reads below 160 mV (the reel: below the 50 Ohm threshold),
+    // otherwise `run` decides what to show from readPairs
+    struct ModeHandler {
+        DetectedMode_t mode;
+        uint16_t exitPairs;
+        uint16_t readPairs;
+        bool exitAtOhm50;
+        void (TesterStateMachine::*run)(const TesterFrame&);
+    };
+    static const ModeHandler handlers[];
+
+    const ModeHandler* handler = nullptr;
+    DetectedMode_t current = MODE_NONE;
+    TesterThresholds thresholds = {};
+
+    Shapes_t shownShape = SHAPE_NONE;
+    DisplayColor_t shownColor = COLOR_WHITE;
+    uint32_t holdUntilMs = 0;     // The display stays as it is until then, only the exit is checked
+    bool clearAfterHold = false;  // Foil: clear when the hold ends and the blade is closed again
+    int openFrames = 0;           // Foil: frames in a row with the blade open, and when the first one was
+    uint32_t openSinceMs = 0;
+    int hysteresisMv = 0;
+    // Lame: the shown color stays while the reading is inside its band widened by hysteresisMv, and changes once
+    // the reading has been outside for LAME_DEBOUNCE_MS
+    Debouncer<HysteresisBand> lameDebounce{HysteresisBand(0, 0, 0), LAME_DEBOUNCE_MS};
+
+    DisplayCommand* out = nullptr;
+    int count = 0;
+
+    void emit(DisplayOp_t op, Shapes_t shape = SHAPE_NONE, DisplayColor_t color = COLOR_WHITE);
+    void clear();
+    void show(Shapes_t shape, DisplayColor_t color);
+    void showInner9(DisplayColor_t color);
+    void hold(const TesterFrame& frame, uint32_t ms) { holdUntilMs = frame.timeMs + ms; }
+
+    void runEpee(const TesterFrame& frame);
+    void runFoil(const TesterFrame& frame);
+    void runLame(const TesterFrame& frame);
+    void runLameTop(const TesterFrame& frame);
+    void runReel(const TesterFrame& frame);
+    void showLameBand(const TesterFrame& frame, Pair_t pair);
+};
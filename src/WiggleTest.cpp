@@ -0,0 +1,127 @@
+#include "WiggleTest.h"
+
+#include <limits.h>
+
+#include "AdcStream.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "resitancemeasurement.h"
+
+namespace {
+
+// cr, ar and br high, cl, piste and bl low, al stays an input. Without cross connections the three loops are
+// independent, but they share the driver supply and ground, so a wire can read a little different than with its
+// own pair pattern. beginWiggleTest measures that difference.
+constexpr DrivePattern WIGGLE_PATTERN = makeDrivePattern(129, 56);
+constexpr adc1_channel_t wiggleRight[3] = {cr_analog, ar_analog, br_analog};
+constexpr adc1_channel_t wiggleLeft[3] = {cl_analog, piste_analog, bl_analog};
+constexpr uint32_t WIGGLE_WDT_ROUNDS = 256;  // Watchdog reset interval, it costs more than a conversion
+
+int readWiggleWire(int w) {
+    int right = adc1_get_raw(wiggleRight[w]);
+    return adcRawToMilliVolts(right) - adcRawToMilliVolts(adc1_get_raw(wiggleLeft[w]));
+}
+
+void applyWigglePattern() {
+    int settleUs = 0;
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        settleUs = getSettleTimeUs((Pair_t)i) > settleUs ? getSettleTimeUs((Pair_t)i) : settleUs;
+    }
+    applyDrivePattern(WIGGLE_PATTERN);
+    delayMicroseconds(settleUs);
+}
+
+// Closes the open break of wire w at `now`, the break lasted from its first open sample up to then
+void closeBreak(WiggleReport& report, int w, int64_t now, uint32_t minBreakUs) {
+    WiggleWireStats& wire = report.wires[w];
+    uint32_t length = now - report.breakStartUs[w];
+    wire.longestBreakUs = length > wire.longestBreakUs ? length : wire.longestBreakUs;
+    if (length >= minBreakUs) {
+        wire.dropouts++;
+        report.droppedOut = true;
+    }
+    report.breakStartUs[w] = -1;
+}
+
+}  // namespace
+
+void beginWiggleTest(WiggleReport& report, int breakThresholdMv) {
+    report.streamWasRunning = adcStream().isRunning();
+    if (report.streamWasRunning) {
+        adcStream().end();
+    }
+
+    int own[3];
+    for (int w = 0; w < 3; w++) {
+        applyDrivePattern((Pair_t)(w * 3 + w));
+        own[w] = getDifferentialSampleFixed(wiggleRight[w], wiggleLeft[w], MAX_NUM_ADC_SAMPLES);
+    }
+    applyWigglePattern();
+    for (int w = 0; w < 3; w++) {
+        long sum = 0;
+        for (int i = 0; i < MAX_NUM_ADC_SAMPLES; i++) {
+            sum += readWiggleWire(w);
+        }
+        // An open wire reads the supply either way, there is nothing to compare
+        int offset = own[w] <= breakThresholdMv ? sum / MAX_NUM_ADC_SAMPLES - own[w] : 0;
+        report.wires[w] = {INT_MAX, INT_MIN, 0, 0, 0, offset};
+        report.breakStartUs[w] = -1;
+    }
+    report.breakThresholdMv = breakThresholdMv;
+    report.rounds = 0;
+    report.worstGapUs = 0;
+    report.durationUs = 0;
+    report.droppedOut = false;
+    report.startUs = esp_timer_get_time();
+    report.lastSampleUs = report.startUs;
+}
+
+bool continueWiggleTest(WiggleReport& report, uint32_t durationUs, uint32_t minBreakUs, bool stopOnDropout) {
+    // Other tasks may have driven the pins since the last slice
+    applyWigglePattern();
+
+    int64_t start = esp_timer_get_time();
+    int64_t now = start;
+    while (now - start < durationUs && !(stopOnDropout && report.droppedOut)) {
+        for (int w = 0; w < 3; w++) {
+            WiggleWireStats& wire = report.wires[w];
+            int value = readWiggleWire(w) - wire.patternOffsetMv;
+            wire.lastMv = value;
+            wire.minMv = value < wire.minMv ? value : wire.minMv;
+            wire.maxMv = value > wire.maxMv ? value : wire.maxMv;
+            if (value > report.breakThresholdMv) {
+                if (report.breakStartUs[w] < 0) {
+                    report.breakStartUs[w] = now;
+                } else if (stopOnDropout && now - report.breakStartUs[w] >= minBreakUs) {
+                    // A wire that stays open, a cord pulled out, has to end the run as well
+                    closeBreak(report, w, now, minBreakUs);
+                }
+            } else if (report.breakStartUs[w] >= 0) {
+                closeBreak(report, w, now, minBreakUs);
+            }
+        }
+        report.rounds++;
+        if (report.rounds % WIGGLE_WDT_ROUNDS == 0) {
+            esp_task_wdt_reset();
+        }
+        now = esp_timer_get_time();
+        if (now - report.lastSampleUs > report.worstGapUs) {
+            report.worstGapUs = now - report.lastSampleUs;
+        }
+        report.lastSampleUs = now;
+    }
+    report.durationUs = now - report.startUs;
+    return report.droppedOut;
+}
+
+bool endWiggleTest(WiggleReport& report, uint32_t minBreakUs) {
+    for (int w = 0; w < 3; w++) {
+        if (report.breakStartUs[w] >= 0) {
+            closeBreak(report, w, report.lastSampleUs, minBreakUs);
+        }
+    }
+    if (report.streamWasRunning) {
+        adcStream().begin();
+    }
+    return report.droppedOut;
+}
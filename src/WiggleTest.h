@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+
+// One straight wire over a wiggle test run, differentials in mV like measurements[Nr][Nr]
+struct WiggleWireStats {
+    int minMv;
+    int maxMv;
+    int lastMv;
+    uint32_t dropouts;        // Breaks of at least minBreakUs
+    uint32_t longestBreakUs;  // Longest break seen, also the ones shorter than minBreakUs
+    int patternOffsetMv;      // Shared pattern minus own pair pattern at the start, taken off every sample
+};
+
+struct WiggleReport {
+    WiggleWireStats wires[3];  // cr-cl, ar-piste, br-bl
+    uint32_t rounds;           // Samples taken of every wire
+    uint32_t durationUs;
+    uint32_t worstGapUs;  // Longest time between two samples of the same wire, shorter breaks can be missed
+    // Run state carried from one slice to the next
+    int breakThresholdMv;
+    bool streamWasRunning;
+    bool droppedOut;
+    int64_t startUs;
+    int64_t lastSampleUs;
+    int64_t breakStartUs[3];  // Start of a break that is still open, -1 when the wire is closed
+};
+
+// Intermittent break detector for the wire test. The three straight wires are driven at once by a single pattern,
+// so nothing switches while it runs, and every wire's differential is sampled as fast as adc1_get_raw goes. That is
+// not the ADC's maximum rate: a round is six one-shot conversions, so each wire is sampled once per round,
+// durationUs / rounds apart on average and worstGapUs at worst. That interval is the shortest break it can reliably
+// see. The DMA stream would be faster but only converts a two-channel pattern.
+// A sample above breakThresholdMv is open; an open stretch of minBreakUs or longer counts as a dropout.
+// The run goes in slices: beginWiggleTest, then continueWiggleTest as often as needed, with room for other tasks
+// in between, and endWiggleTest. A break that is open at the end of a slice carries over into the next one, the
+// time between slices shows up in worstGapUs. The DMA stream is stopped from begin to end, so the caller must be
+// the tester task, between two of its measurements.
+
+// Clears the report and measures each connected wire with its own pair pattern and with the shared one. The
+// difference is taken off every sample, so breakThresholdMv means the same as in testStraightOnly.
+void beginWiggleTest(WiggleReport& report, int breakThresholdMv);
+// Samples for durationUs, or until the first dropout with stopOnDropout, which also counts a break that is still
+// open once it is minBreakUs long. Returns true if any wire dropped out.
+bool continueWiggleTest(WiggleReport& report, uint32_t durationUs, uint32_t minBreakUs, bool stopOnDropout);
+// A wire that is still open counts as a break, possibly an unplugged cord. Restarts the DMA stream if it was running.
+// Returns true if any wire dropped out during the run.
+bool endWiggleTest(WiggleReport& report, uint32_t minBreakUs);
@@ -5,6 +5,7 @@
 #include <math.h>
 #include <string.h>
 
+#include "AdcStream.h"
 #include "esp_system.h"
 #include "esp_task_wdt.h"
 #include "esp_vfs_dev.h"
@@ -12,6 +13,7 @@
 #include "freertos/task.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "resitancemeasurement.h"
 
 // ========================================================================
 // EMPIRICAL RESISTOR CALIBRATOR IMPLEMENTATION
@@ -40,6 +42,9 @@ bool EmpiricalResistorCalibrator::begin(adc1_channel_t adc_channel_top, adc1_cha
 
 EmpiricalResistorCalibrator::EmpiricalReading EmpiricalResistorCalibrator::read_differential_empirical(int samples) {
     EmpiricalReading result;
+    // adc1_get_raw below must not run next to the DMA stream
+    bool streamWasRunning = adcStream().isRunning();
+    adcStream().end();
     // Use the same successful approach as the working differential calibrator
     const float trim_percent = 0.2f;  // Remove 20% outliers like the working differential calibrator
 
@@ -96,6 +101,9 @@ EmpiricalResistorCalibrator::EmpiricalReading EmpiricalResistorCalibrator::read_
     // Clean up arrays
     delete[] mv_top_samples;
     delete[] mv_bottom_samples;
+    if (streamWasRunning) {
+        adcStream().begin();
+    }
 
     // Convert millivolts to volts
     result.v_top = avg_mv_top / 1000.0f;
@@ -221,9 +229,13 @@ float EmpiricalResistorCalibrator::calculate_model_voltage(float R_known, float
     return v_gpio * R_known / (R_known + r1_r2 + correction / R_known);
 }
 
-// Helper function to convert voltage to ADC raw value using binary search
+// Helper function to convert voltage to ADC raw value
+// Uses the inverse table built by init_AD, with the binary search as fallback before it exists
 
 int EmpiricalResistorCalibrator::voltage_to_adc_raw(float voltage) {
+    if (adcLookupTablesReady()) {
+        return adcMilliVoltsToRaw((int)ceilf(voltage * 1000.0f));
+    }
     // Binary search to find ADC value that gives closest voltage
     // Same approach as DifferentialResistorCalibrator
     int low = 0, high = 4095, result = 0;
@@ -35,6 +35,8 @@ using namespace std;
 #include <freertos/task.h>
 
 #include "GpioHoldManager.h"
+#include "MeasurementBenchmarks.h"
+#include "MeasurementSnapshot.h"
 #include "RTOSUtilities.h"
 #include "USBSerialTerminal.h"
 #include "adc_calibrator.h"
@@ -70,6 +72,18 @@ bool MirrorMode = true;  // Default to no mirror mode
 bool IgnoreCalibrationWarning = false;
 bool ShowWelcome = true;
 bool LowPowerMode = false;
+bool UseDmaAdc = false;
+bool AdaptiveSampling = false;
+bool MultiplexedScan = false;
+int MainsFrequency = 0;
+bool TrackLive = false;
+bool AutoRange = false;
+bool ReducedDrive = false;
+bool PresenceProbe = false;
+int MeasurementMaxAge = 0;
+int WiggleMinBreakUs = 0;
+bool ExpressCheck = false;
+int DebounceHysteresis = 0;
 int CalibrationDisplayChannel = 0;   // Default to channel 0
 bool CalibrationAutoMode = false;    // Auto mode flag
 int Brightness = BRIGHTNESS_NORMAL;  // Default brightness level
@@ -106,6 +120,12 @@ void handleHelpCommand(ITerminal* term, const std::vector<String>& args);
 void handleCalibrateCommand(ITerminal* term, const std::vector<String>& args);
 void handleListCommand(ITerminal* term, const std::vector<String>& args);  // Add this
 void handleSetCommand(ITerminal* term, const std::vector<String>& args);   // Add this
+void handleBenchCommand(ITerminal* term, const std::vector<String>& args);
+void handleFrameCommand(ITerminal* term, const std::vector<String>& args);
+void handleSettleCommand(ITerminal* term, const std::vector<String>& args);
+void handleWiggleCommand(ITerminal* term, const std::vector<String>& args);
+void handleExpressCommand(ITerminal* term, const std::vector<String>& args);
+void handleBatchCommand(ITerminal* term, const std::vector<String>& args);
 
 // Command handler class declaration
 class CommonCommandHandler {
@@ -117,6 +137,12 @@ class CommonCommandHandler {
         terminal->registerCommand("calibrate", handleCalibrateCommand);
         terminal->registerCommand("list", handleListCommand);
         terminal->registerCommand("set", handleSetCommand);
+        terminal->registerCommand("bench", handleBenchCommand);
+        terminal->registerCommand("frame", handleFrameCommand);
+        terminal->registerCommand("settle", handleSettleCommand);
+        terminal->registerCommand("wiggle", handleWiggleCommand);
+        terminal->registerCommand("express", handleExpressCommand);
+        terminal->registerCommand("batch", handleBatchCommand);
         terminal->registerCommand("help", handleHelpCommand);
     }
 };
@@ -174,6 +200,11 @@ void handleCalibrateCommand(ITerminal* term, const std::vector<String>& args) {
         term->printf("v_gpio = %f\n", tester->get_v_gpio());
         term->printf("r1r2 = %f\n", tester->get_r1_r2());
         term->printf("correction = %f\n", tester->get_correction());
+        if (tester->hasReducedDriveCalibration()) {
+            const EmpiricalResistorCalibrator& reduced = tester->getReducedDriveCalibrator();
+            term->printf("reduced drive: v_gpio = %f, r1r2 = %f, correction = %f\n", reduced.get_v_gpio(),
+                         reduced.get_r1_r2(), reduced.get_correction());
+        }
     }
 }
 
@@ -323,6 +354,31 @@ void LoadSettings() {
     settings.addBool("IgnoreCalibrationWarning", "Ignore warning to Calibrate?", &IgnoreCalibrationWarning);
     settings.addBool("ShowWelcome", "Show welcome lights (for debugging)?", &ShowWelcome);
     settings.addBool("LowPowerMode", "Apply low power settings (slightly lower response times)", &LowPowerMode);
+    settings.addBool("DmaAdc", "Sample the ADC continuously with DMA (faster scans)", &UseDmaAdc);
+    settings.addBool("AdaptiveSample", "Stop sampling early when a reading is far from all thresholds",
+                     &AdaptiveSampling);
+    settings.addBool("MuxScan", "Read a whole row of the wire matrix per drive pattern", &MultiplexedScan);
+    // Costs a full mains period per pair, about 180 ms for the nine wire pairs at 50 Hz. Gaps of two ticks and
+    // more between samples sleep, shorter ones spin on the tester's core.
+    settings.addInt("MainsFrequency", "Spread samples over one mains period to cancel hum: 0 (off), 50 or 60",
+                    &MainsFrequency);
+    settings.addBool("TrackLive", "Filter the live colors over time, fewer samples per refresh", &TrackLive);
+    settings.addBool("AutoRange", "Read low resistances at 6 dB attenuation for finer resolution", &AutoRange);
+    settings.addBool("ReducedDrive", "Weaker drivers for reel and lame tests, needs its own calibration",
+                     &ReducedDrive);
+    settings.addBool("PresenceProbe", "Idle loop only scans fully when something gets plugged in", &PresenceProbe);
+    settings.addInt("MeasurementMaxAge", "Reuse a pair's reading for this many us, 0 (off) or e.g. 2000",
+                    &MeasurementMaxAge);
+    // Each wire is sampled once per round of six one-shot conversions, not at the ADC's maximum rate. The wiggle
+    // command shows that interval; breaks shorter than it can be missed, so it is the lower bound for this value.
+    settings.addInt("WiggleMinBreakUs", "Wire test flags breaks of at least this many us, 0 (off) or e.g. 200",
+                    &WiggleMinBreakUs);
+    settings.addInt("DebounceHysteresis", "mV a lame reading must leave its color band by, 0 (off) or e.g. 15",
+                    &DebounceHysteresis);
+    // Replaces both wire test phases: after the verdict each wire is read once per scan instead of in the tight
+    // phase 2 loop, so breaks shorter than about two scans (20 ms) go unnoticed
+    settings.addBool("ExpressCheck", "Body cords: one pass/fail frame as soon as the readings settle",
+                     &ExpressCheck);
     settings.addInt("Brightness", "Display brightness 1-255", &Brightness);
     settings.addString("name", "Device Name", &deviceName);
     // settings.addInt("R1_R2", "R1_R2 (total resistance (Ron + 2 x 47)", &R0);
@@ -416,6 +472,240 @@ void handleRebootCommand(ITerminal* term, const std::vector<String>& args) {
     ESP.restart();
 }
 
+// A terminal job for Tester::runInTesterTask
+struct TerminalJob {
+    void (*run)(ITerminal* term);
+    ITerminal* term;
+};
+
+// The tester task uses the same pins, ADC channels and DMA stream, so measurement jobs run in it, between two of its
+// passes. Without a tester task the job runs right here.
+bool runOnTesterTask(ITerminal* term, void (*run)(ITerminal* term)) {
+    if (tester == nullptr) {
+        run(term);
+        return true;
+    }
+    TerminalJob job = {run, term};
+    return tester->runInTesterTask(
+        [](void* context) {
+            TerminalJob* job = static_cast<TerminalJob*>(context);
+            job->run(job->term);
+        },
+        &job);
+}
+
+void handleBenchCommand(ITerminal* term, const std::vector<String>& args) {
+    if (args.empty()) {
+        term->printf("Usage: bench <drive|adc|estimator|adaptive|schedule|mux|order|presence|cache|autorange>\n");
+        term->printf("  drive     - drive pattern switch cost (pinMode vs register writes)\n");
+        term->printf("  adc       - samples per second, polling vs DMA stream\n");
+        term->printf("  estimator - robust estimators at 16 and 64 samples vs insertion sort\n");
+        term->printf("  adaptive  - scan time and samples per pair, fixed vs adaptive sampling\n");
+        term->printf("  schedule  - time per scan for the full and the per-mode partial scans\n");
+        term->printf("  mux       - multiplexed row scan vs per-pair scan, time and agreement\n");
+        term->printf("  order     - row major vs minimum switching scan order, time and noise\n");
+        term->printf("  presence  - waiting loop pass vs presence probe, time per iteration\n");
+        term->printf("  cache     - repeated reads of one pair with and without the measurement cache\n");
+        return;
+    }
+
+    void (*benchmark)(ITerminal*) = nullptr;
+    if (args[0] == "drive") {
+        benchmark = benchmarkDrivePatterns;
+    } else if (args[0] == "adc") {
+        benchmark = benchmarkAdcThroughput;
+    } else if (args[0] == "estimator") {
+        benchmark = benchmarkEstimators;
+    } else if (args[0] == "adaptive") {
+        benchmark = benchmarkAdaptiveSampling;
+    } else if (args[0] == "schedule") {
+        benchmark = benchmarkScanSchedules;
+    } else if (args[0] == "mux") {
+        benchmark = benchmarkMultiplexedScan;
+    } else if (args[0] == "order") {
+        benchmark = benchmarkScanOrder;
+    } else if (args[0] == "presence") {
+        benchmark = benchmarkPresenceProbe;
+    } else if (args[0] == "cache") {
+        benchmark = benchmarkMeasurementCache;
+    } else if (args[0] == "autorange") {
+        benchmark = benchmarkAutoRange;
+    } else {
+        term->printf("Unknown benchmark '%s'\n", args[0].c_str());
+        return;
+    }
+    if (!runOnTesterTask(term, benchmark)) {
+        term->printf("The tester is busy with a test, try again when it is waiting\n");
+    }
+}
+
+void handleFrameCommand(ITerminal* term, const std::vector<String>& args) {
+    MeasurementFrame frame;
+    if (!measurementSnapshot().read(frame)) {
+        term->printf("No measurement frame yet\n");
+        return;
+    }
+    term->printf("Frame %lu, %lu ms old (mV, rows cr/ar/br, columns cl/piste/bl)\n", (unsigned long)frame.sequence,
+                 (unsigned long)((esp_timer_get_time() - frame.timestampUs) / 1000));
+    for (int Nr = 0; Nr < 3; Nr++) {
+        term->printf("  %5d %5d %5d\n", frame.values[Nr][0], frame.values[Nr][1], frame.values[Nr][2]);
+    }
+}
+
+void handleSettleCommand(ITerminal* term, const std::vector<String>& args) {
+    static const char* pairNames[NUM_PAIRS] = {"CrCl", "CrPiste", "CrBl", "ArCl", "ArPiste", "ArBl", "BrCl",
+                                               "BrPiste", "BrBl", "ArBr", "ArCr", "BrCr", "ClPiste"};
+    if (!args.empty() && args[0] == "run") {
+        term->printf("Characterizing pattern settling, keep everything unplugged...\n");
+        if (!runOnTesterTask(term, [](ITerminal*) { characterizeSettling(); })) {
+            term->printf("The tester is busy with a test, try again when it is waiting\n");
+            return;
+        }
+        saveSettleTimesToNvs();
+    } else if (!args.empty() && args[0] == "clear") {
+        clearSettleTimes();
+        saveSettleTimesToNvs();
+    } else if (!args.empty()) {
+        term->printf("Usage: settle [run|clear]\n");
+        return;
+    }
+    term->printf("Dead time per pattern:\n");
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        term->printf("  %-8s: %4d us\n", pairNames[i], getSettleTimeUs((Pair_t)i));
+    }
+}
+
+void handleWiggleCommand(ITerminal* term, const std::vector<String>& args) {
+    static const char* wireNames[3] = {"CrCl", "ArPiste", "BrBl"};
+    int durationMs = args.empty() ? 5000 : args[0].toInt();
+    if (durationMs <= 0 || tester == nullptr) {
+        term->printf("Usage: wiggle [ms], with a body cord plugged in\n");
+        return;
+    }
+    term->printf("Flex the cord near the plugs for %d ms...\n", durationMs);
+    WiggleReport report;
+    if (!tester->runWiggle(report, (uint32_t)durationMs * 1000)) {
+        term->printf("The tester is busy with a test, try again when it is waiting\n");
+        return;
+    }
+
+    unsigned long averageGapUs = report.rounds ? report.durationUs / report.rounds : 0;
+    term->printf("%lu samples per wire, one every %lu us on average and %lu us at worst\n",
+                 (unsigned long)report.rounds, averageGapUs, (unsigned long)report.worstGapUs);
+    for (int i = 0; i < 3; i++) {
+        const WiggleWireStats& wire = report.wires[i];
+        term->printf("  %-8s: %5d to %5d mV, %lu dropouts, longest break %lu us, pattern offset %d mV\n",
+                     wireNames[i], wire.minMv, wire.maxMv, (unsigned long)wire.dropouts,
+                     (unsigned long)wire.longestBreakUs, wire.patternOffsetMv);
+    }
+}
+
+void handleExpressCommand(ITerminal* term, const std::vector<String>& args) {
+    if (tester == nullptr) {
+        return;
+    }
+    if (!args.empty() && args[0] == "reset") {
+        tester->resetExpressStats();
+    } else if (!args.empty()) {
+        term->printf("Usage: express [reset]\n");
+        return;
+    }
+    ExpressStats stats = tester->getExpressStats();
+    term->printf("Express check %s: %lu cords, %lu passed\n", ExpressCheck ? "on" : "off", (unsigned long)stats.cords,
+                 (unsigned long)stats.passed);
+    if (!stats.cords) {
+        return;
+    }
+    term->printf("  plug-in to verdict: last %lu ms, average %lu ms\n", (unsigned long)stats.lastCordMs,
+                 (unsigned long)(stats.totalCordMs / stats.cords));
+    // Throughput includes the handling between cords, from the first plug-in to the last verdict
+    uint32_t sessionMs = stats.lastVerdictMs - stats.firstStartMs;
+    if (sessionMs > 0) {
+        term->printf("  %.1f cords/min over %lu s\n", stats.cords * 60000.0f / sessionMs,
+                     (unsigned long)(sessionMs / 1000));
+    }
+}
+
+void printCordFaults(ITerminal* term, uint16_t faults) {
+    static const char* wireNames[3] = {"CrCl", "ArPiste", "BrBl"};
+    if (!faults) {
+        term->printf(" ok");
+    }
+    for (int wire = 0; wire < 3; wire++) {
+        uint8_t wireFault = (faults >> (3 * wire)) & 7;
+        if (wireFault & CORD_FAULT_BROKEN) {
+            term->printf(" %s broken", wireNames[wire]);
+        }
+        if (wireFault & CORD_FAULT_SHORT) {
+            term->printf(" %s short", wireNames[wire]);
+        }
+        if (wireFault & CORD_FAULT_SWAPPED) {
+            term->printf(" %s swapped", wireNames[wire]);
+        }
+    }
+    term->printf("\n");
+}
+
+void handleBatchCommand(ITerminal* term, const std::vector<String>& args) {
+    static const char* wireNames[3] = {"CrCl", "ArPiste", "BrBl"};
+    if (tester == nullptr) {
+        return;
+    }
+    BatchSession& batch = tester->getBatchSession();
+    if (!args.empty() && args[0] == "start") {
+        batch.start(millis());
+        term->printf("Batch session started, plug in the first cord\n");
+        return;
+    }
+    if (!args.empty() && args[0] == "stop") {
+        batch.stop();
+    } else if (!args.empty() && args[0] == "list") {
+        term->printf("  seq  duration  CrCl    ArPiste BrBl    (Ohm)  faults\n");
+        for (int i = 0; i < batch.recordCount(); i++) {
+            const CordRecord& cord = batch.record(i);
+            term->printf("  %4u %6lu ms", cord.sequence, (unsigned long)cord.durationMs);
+            for (int wire = 0; wire < 3; wire++) {
+                if (cord.leadMilliOhm[wire] == LEAD_NOT_MEASURED) {
+                    term->printf("      - ");
+                } else {
+                    term->printf(" %6.2f ", cord.leadMilliOhm[wire] / 1000.0f);
+                }
+            }
+            term->printf("      ");
+            printCordFaults(term, cord.faults);
+        }
+        return;
+    } else if (!args.empty()) {
+        term->printf("Usage: batch [start|stop|list]\n");
+        return;
+    }
+
+    term->printf("Batch session %s: %lu cords, %lu passed\n", batch.isActive() ? "running" : "stopped",
+                 (unsigned long)batch.cords(), (unsigned long)batch.passed());
+    if (!batch.cords()) {
+        return;
+    }
+    term->printf("  faults: %lu broken, %lu short, %lu swapped\n",
+                 (unsigned long)batch.faultCount(CORD_FAULT_BROKEN), (unsigned long)batch.faultCount(CORD_FAULT_SHORT),
+                 (unsigned long)batch.faultCount(CORD_FAULT_SWAPPED));
+    term->printf("  per cord: %lu ms average, %lu ms longest, %.1f cords/min over %lu s\n",
+                 (unsigned long)batch.averageDurationMs(), (unsigned long)batch.maxDurationMs(), batch.cordsPerMinute(),
+                 (unsigned long)(batch.sessionMs() / 1000));
+    for (int wire = 0; wire < 3; wire++) {
+        const LeadDistribution& lead = batch.lead(wire);
+        if (!lead.count) {
+            continue;
+        }
+        term->printf("  %-8s: %lu leads, %.2f to %.2f Ohm, mean %.2f, sd %.2f\n", wireNames[wire],
+                     (unsigned long)lead.count, lead.minOhm, lead.maxOhm, lead.mean(), lead.standardDeviation());
+        term->printf("            per %.2f Ohm:", BATCH_HISTOGRAM_BIN_OHM);
+        for (int bin = 0; bin < BATCH_HISTOGRAM_BINS; bin++) {
+            term->printf(" %u", lead.histogram[bin]);
+        }
+        term->printf("\n");
+    }
+}
+
 void handleHelpCommand(ITerminal* term, const std::vector<String>& args) {
     term->send("Available commands:");
     term->send("  echo <text>          - Echo back the text");
@@ -423,6 +713,12 @@ void handleHelpCommand(ITerminal* term, const std::vector<String>& args) {
     term->send("  calibrate            - Start calibration");
     term->send("  list                 - Show available settings");
     term->send("  set <name> <value>   - Change a setting");
+    term->send("  bench <name>         - Run a measurement benchmark");
+    term->send("  frame                - Show the latest 3x3 measurement frame");
+    term->send("  settle [run|clear]   - Show, measure or clear the per-pattern dead times");
+    term->send("  wiggle [ms]          - Watch the plugged-in body cord for breaks while it is flexed");
+    term->send("  express [reset]      - Show or reset the express check throughput");
+    term->send("  batch [start|stop|list] - Start, stop or list the body cord batch, summary without argument");
     term->send("  help                 - Show this help message");
 }
 
@@ -456,10 +752,25 @@ void setup() {
     Serial.printf("CPU Freq: %d MHz\n", getCpuFrequencyMhz());
     printf("App version: %s\n", APP_VERSION);
     init_AD();
+    loadSettleTimesFromNvs();
+    setAdaptiveSampling(AdaptiveSampling);
+    setMultiplexedScan(MultiplexedScan);
+    setPairTracking(TrackLive);
+    setAutoRanging(AutoRange);
+    setMeasurementCacheMaxAge(MeasurementMaxAge);
+    if (!setMainsFrequency(MainsFrequency)) {
+        printf("MainsFrequency must be 0, 50 or 60, ignoring %d\n", MainsFrequency);
+    }
     Set_IODirectionAndValue(IODirection_br_bl, IOValues_br_bl);
 
     tester = new Tester(LedPanel);
     tester->setIgnoreCalibrationWarning(IgnoreCalibrationWarning);
+    tester->setUseDmaAdc(UseDmaAdc);
+    tester->setUseReducedDrive(ReducedDrive);
+    tester->setUsePresenceProbe(PresenceProbe);
+    tester->setWiggleMinBreakUs(WiggleMinBreakUs > 0 ? WiggleMinBreakUs : 0);
+    tester->setExpressCheck(ExpressCheck);
+    tester->setDebounceHysteresisMv(DebounceHysteresis);
 
     // Start the tester task
     tester->begin(CalibrationEnabled);
@@ -1,12 +1,16 @@
 #include <Arduino.h>
 
+#include "AdcStream.h"
+#include "MeasurementSnapshot.h"
+#include "RobustEstimator.h"
+#include "ScalarKalman.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
 #include "esp_task_wdt.h"
-
-// Number of ADC samples to take for each measurement
-constexpr int MAX_NUM_ADC_SAMPLES = 64;
-#define NUM_ADC_SAMPLES 16
+#include "esp_timer.h"
+#include "nvs.h"
+#include "resitancemeasurement.h"
+#include "soc/gpio_reg.h"
 
 // If you have different pins, change below defines
 
@@ -76,7 +80,9 @@ constexpr int MAX_NUM_ADC_SAMPLES = 64;
 const uint8_t driverpins[] = {al_driver, bl_driver, cl_driver, ar_driver, br_driver, cr_driver, piste_driver};
 int measurements[3][3];
 
-void Set_IODirectionAndValue(uint8_t setting, uint8_t values) {
+// Reference implementation: one pinMode/digitalWrite per driver pin.
+// Only used at startup (it routes the driver pins through the GPIO matrix) and as benchmark reference.
+void Set_IODirectionAndValueLegacy(uint8_t setting, uint8_t values) {
     uint8_t mask = 1;
     for (int i = 0; i < 7; i++) {
         if (setting & mask) {
@@ -93,61 +99,379 @@ void Set_IODirectionAndValue(uint8_t setting, uint8_t values) {
     }
 }
 
+// Output levels are written before the enables, so a pin that turns into an output
+// never briefly drives its previous level.
+void IRAM_ATTR applyDrivePattern(const DrivePattern& pattern) {
+    REG_WRITE(GPIO_OUT_W1TS_REG, pattern.out_set);
+    REG_WRITE(GPIO_OUT_W1TC_REG, pattern.out_clear);
+    REG_WRITE(GPIO_OUT1_W1TS_REG, pattern.out1_set);
+    REG_WRITE(GPIO_OUT1_W1TC_REG, pattern.out1_clear);
+    REG_WRITE(GPIO_ENABLE_W1TC_REG, pattern.enable_clear);
+    REG_WRITE(GPIO_ENABLE1_W1TC_REG, pattern.enable1_clear);
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, pattern.enable_set);
+    REG_WRITE(GPIO_ENABLE1_W1TS_REG, pattern.enable1_set);
+}
+
+void Set_IODirectionAndValue(uint8_t setting, uint8_t values) { applyDrivePattern(makeDrivePattern(setting, values)); }
+
 esp_adc_cal_characteristics_t adc_chars;
+esp_adc_cal_characteristics_t adc_chars_db6;  // For auto-ranged readings
+
+// esp_adc_cal_raw_to_voltage evaluated once for every raw code, plus its inverse:
+// milliVoltsToRaw[mV] is the largest raw code that converts to less than mV (0 if there is none),
+// the same answer the binary search over esp_adc_cal_raw_to_voltage gives.
+constexpr int ADC_RAW_RANGE = 4096;
+constexpr int ADC_MV_RANGE = 4096;
+uint16_t rawToMilliVolts[ADC_RAW_RANGE];
+uint16_t milliVoltsToRaw[ADC_MV_RANGE + 1];
+uint16_t rawToMilliVoltsDb6[ADC_RAW_RANGE];
+bool adcLookupTablesBuilt = false;
+
+void buildAdcLookupTables() {
+    for (int raw = 0; raw < ADC_RAW_RANGE; raw++) {
+        rawToMilliVolts[raw] = esp_adc_cal_raw_to_voltage(raw, &adc_chars);
+        rawToMilliVoltsDb6[raw] = esp_adc_cal_raw_to_voltage(raw, &adc_chars_db6);
+    }
+    // esp_adc_cal_raw_to_voltage is monotone, so one sweep fills the inverse
+    int raw = 0;
+    int below = 0;
+    for (int mv = 0; mv <= ADC_MV_RANGE; mv++) {
+        while (raw < ADC_RAW_RANGE && rawToMilliVolts[raw] < mv) {
+            below = raw;
+            raw++;
+        }
+        milliVoltsToRaw[mv] = below;
+    }
+    adcLookupTablesBuilt = true;
+}
 
 // Forward declarations
 // void calibrateADCOffsets();
 int getCalibratedVoltage(int raw_value, adc1_channel_t channel);
 
+int robustChannelMean(const int* samples, int nr_samples);
+
 int samples1[MAX_NUM_ADC_SAMPLES];
 int samples2[MAX_NUM_ADC_SAMPLES];
 
-int getDifferentialSample(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples = NUM_ADC_SAMPLES) {
-    // Collect NUM_ADC_SAMPLES samples from each pin
-    for (int i = 0; i < nr_samples; i++) {
+// Fills samples1/samples2 from index `offset` on, from the DMA stream when it runs, otherwise by
+// polling adc1_get_raw. Returns the number of sample pairs actually collected.
+int acquireSamples(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples, int offset) {
+    if (adcStream().isRunning()) {
+        int collected =
+            adcStream().readPair(pin1, pin2, samples1 + offset, samples2 + offset, nr_samples, offset == 0);
+        if (collected > 0) {
+            return collected;
+        }
+        // adc1_get_raw must not run next to the stream, so a stream that stopped delivering is shut down for good
+        printf("AdcStream: no conversions on channels %d/%d, back to polling\n", pin1, pin2);
+        adcStream().end();
+    }
+    for (int i = offset; i < offset + nr_samples; i++) {
         esp_task_wdt_reset();
         samples1[i] = adc1_get_raw(pin1);
         esp_task_wdt_reset();
         samples2[i] = adc1_get_raw(pin2);
     }
+    return nr_samples;
+}
+
+// Mains-synchronous acquisition: the samples are spread evenly over one mains period, so hum at the mains
+// frequency and its harmonics below nr_samples / 2 averages out. Costs one full period per pair, 20 ms at 50 Hz.
+int mainsFrequencyHz = 0;
+
+// The DMA stream converts at a fixed rate far above what one mains period needs, so only when polling
+bool mainsSyncActive() { return mainsFrequencyHz && !adcStream().isRunning(); }
 
-    // Simple insertion sort for NUM_ADC_SAMPLES elements (very fast)
-    for (int i = 1; i < nr_samples; i++) {
-        int key1 = samples1[i];
-        int key2 = samples2[i];
-        int j = i - 1;
-        while (j >= 0 && samples1[j] > key1) {
-            samples1[j + 1] = samples1[j];
-            samples2[j + 1] = samples2[j];
-            j--;
+bool setMainsFrequency(int hz) {
+    if (hz != 0 && hz != 50 && hz != 60) {
+        return false;
+    }
+    mainsFrequencyHz = hz;
+    return true;
+}
+
+int getMainsFrequency() { return mainsFrequencyHz; }
+
+int acquireSamplesMainsSync(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    int64_t interval = 1000000 / ((int64_t)mainsFrequencyHz * nr_samples);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < nr_samples; i++) {
+        // Sleep through the whole ticks of the gap, a tick early so the wake-up jitter stays off the sample
+        // instant, and spin only the rest. Gaps under two ticks still spin, yielding to tasks of equal priority.
+        int64_t wait = i * interval - (esp_timer_get_time() - start);
+        if (wait >= 2 * portTICK_PERIOD_MS * 1000) {
+            vTaskDelay(wait / (portTICK_PERIOD_MS * 1000) - 1);
         }
-        samples1[j + 1] = key1;
-        samples2[j + 1] = key2;
+        while (esp_timer_get_time() - start < i * interval) {
+            taskYIELD();
+        }
+        esp_task_wdt_reset();
+        samples1[i] = adc1_get_raw(pin1);
+        samples2[i] = adc1_get_raw(pin2);
     }
+    return nr_samples;
+}
+
+// Sequential sampling: stop as soon as the confidence interval of the running mean is clear of
+// every threshold the tester currently decides on. Only readings near a threshold get the full budget.
+constexpr int ADAPTIVE_BLOCK_SAMPLES = 4;
+constexpr int ADAPTIVE_MIN_SAMPLES = 4;
+constexpr float ADAPTIVE_Z = 4.0f;          // Half width of the interval in standard errors
+constexpr float ADAPTIVE_MARGIN_MV = 8.0f;  // Covers ADC quantisation and non-gaussian noise
+constexpr int MAX_ACTIVE_THRESHOLDS = 32;
 
-    // Use trimmed mean (skip top and bottom 10% of samples)
-    int trim_count = nr_samples / 10;  // Remove 10% from each end (20% total)
-    if (trim_count < 1)
-        trim_count = 1;  // Always remove at least 1 sample from each end if we have enough samples
-    if (nr_samples <= 4)
-        trim_count = 0;  // Don't trim if we have too few samples
+bool adaptiveSampling = false;
+int activeThresholds[MAX_ACTIVE_THRESHOLDS];
+int activeThresholdCount = 0;
 
-    int start_idx = trim_count;
-    int end_idx = nr_samples - trim_count;
-    int valid_samples = end_idx - start_idx;
+// Sampling statistics, to compare the fixed and the adaptive mode
+uint32_t sampledPairs = 0;
+uint32_t sampledSamples = 0;
 
-    // Calculate trimmed mean for both sample arrays
-    long sum1 = 0, sum2 = 0;
-    for (int i = start_idx; i < end_idx; i++) {
-        sum1 += samples1[i];
-        sum2 += samples2[i];
+void setAdaptiveSampling(bool enabled) { adaptiveSampling = enabled; }
+
+bool isAdaptiveSampling() { return adaptiveSampling; }
+
+void setActiveThresholds(const int* thresholds, int count) {
+    if (count > MAX_ACTIVE_THRESHOLDS) {
+        count = MAX_ACTIVE_THRESHOLDS;
     }
+    for (int i = 0; i < count; i++) {
+        activeThresholds[i] = thresholds[i];
+    }
+    activeThresholdCount = count;
+}
 
-    int trimmed_mean1 = sum1 / valid_samples;
-    int trimmed_mean2 = sum2 / valid_samples;
+float getAverageSamplesPerPair() { return sampledPairs ? (float)sampledSamples / sampledPairs : 0.0f; }
 
-    int delta = (getCalibratedVoltage(trimmed_mean1, pin1) - getCalibratedVoltage(trimmed_mean2, pin2));
-    return delta;
+void resetSamplingStats() {
+    sampledPairs = 0;
+    sampledSamples = 0;
+}
+
+bool intervalClearOfThresholds(float low, float high, const int* thresholds, int count) {
+    for (int i = 0; i < count; i++) {
+        if (thresholds[i] >= low && thresholds[i] <= high) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int adcRawToMilliVoltsDb6(int raw);
+
+// Millivolts of a raw code taken at the given attenuation, only 11 and 6 dB are characterized
+int convertRaw(int raw, adc1_channel_t channel, adc_atten_t atten) {
+    return atten == ADC_ATTEN_DB_6 ? adcRawToMilliVoltsDb6(raw) : getCalibratedVoltage(raw, channel);
+}
+
+// What every measurement returns: the difference of the per-channel trimmed means of the first nr_samples
+// entries of samples1/samples2
+int trimmedDifferential(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples,
+                        adc_atten_t atten = ADC_ATTEN_DB_11) {
+    return convertRaw(robustChannelMean(samples1, nr_samples), pin1, atten) -
+           convertRaw(robustChannelMean(samples2, nr_samples), pin2, atten);
+}
+
+// Auto-ranging: a connected low-resistance pair keeps both nodes around half the supply, inside the 6 dB range, where
+// one code is about 0.43 mV instead of 0.8 mV. With the same noise in codes at both ranges half the samples still give
+// a smaller standard error; "bench autorange" measures both on the connected cord.
+constexpr int AUTORANGE_PROBE_SAMPLES = 4;
+constexpr int AUTORANGE_DB6_LIMIT_MV = 1700;  // The 6 dB range is specified up to 1750 mV
+
+bool autoRanging = false;
+
+void setAutoRanging(bool enabled) { autoRanging = enabled; }
+
+bool isAutoRanging() { return autoRanging; }
+
+// The stream's attenuation is part of its conversion pattern, so auto-ranging needs polling
+bool autoRangeActive() { return autoRanging && !adcStream().isRunning(); }
+
+void setRange(adc1_channel_t pin1, adc1_channel_t pin2, adc_atten_t atten) {
+    adc1_config_channel_atten(pin1, atten);
+    adc1_config_channel_atten(pin2, atten);
+}
+
+// True when samples from `offset` on, taken at `atten`, are all low enough for the 6 dB range
+bool fitsLowRange(adc1_channel_t pin1, adc1_channel_t pin2, int offset, int count, adc_atten_t atten) {
+    for (int i = offset; i < offset + count; i++) {
+        if (convertRaw(samples1[i], pin1, atten) > AUTORANGE_DB6_LIMIT_MV ||
+            convertRaw(samples2[i], pin2, atten) > AUTORANGE_DB6_LIMIT_MV) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Smallest 6 dB code that converts to at least milliVolts, the conversion is monotone
+int milliVoltsToRawDb6(int milliVolts) {
+    int low = 0;
+    int high = ADC_RAW_RANGE - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (adcRawToMilliVoltsDb6(mid) < milliVolts) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// The start of every polled one-shot measurement: up to AUTORANGE_PROBE_SAMPLES at 11 dB into samples1/samples2. When
+// they all fit the 6 dB range the channels are left at 6 dB, the probe samples are rewritten as the 6 dB codes of
+// the same voltages so they count towards the reading, and `budget` is halved. Returns the samples taken, `atten`
+// is the range samples1/samples2 are in. Put the channels back with setRange(..., ADC_ATTEN_DB_11) after a 6 dB read.
+int probeRange(adc1_channel_t pin1, adc1_channel_t pin2, int& budget, adc_atten_t& atten) {
+    atten = ADC_ATTEN_DB_11;
+    if (!autoRangeActive() || budget <= 0) {
+        return 0;
+    }
+    int got = acquireSamples(pin1, pin2, budget < AUTORANGE_PROBE_SAMPLES ? budget : AUTORANGE_PROBE_SAMPLES);
+    if (got <= 0 || !fitsLowRange(pin1, pin2, 0, got, ADC_ATTEN_DB_11)) {
+        return got > 0 ? got : 0;
+    }
+    for (int i = 0; i < got; i++) {
+        samples1[i] = milliVoltsToRawDb6(adcRawToMilliVolts(samples1[i]));
+        samples2[i] = milliVoltsToRawDb6(adcRawToMilliVolts(samples2[i]));
+    }
+    setRange(pin1, pin2, ADC_ATTEN_DB_6);
+    atten = ADC_ATTEN_DB_6;
+    budget = budget / 2 < got ? got : budget / 2;
+    return got;
+}
+
+// The interval is taken around the value that is returned, the trimmed differential. Its standard error comes
+// from the spread of the per-sample differential, which the trim can only make smaller.
+MeasurementResult measureDifferentialAdaptive(adc1_channel_t pin1, adc1_channel_t pin2, int max_samples,
+                                              const int* thresholds, int count) {
+    MeasurementResult result = {0, 0, 0, esp_timer_get_time()};
+    adc_atten_t atten;
+    int collected = probeRange(pin1, pin2, max_samples, atten);
+    int summed = 0;
+    float mean = 0.0f;
+    float m2 = 0.0f;  // Welford running sum of squared deviations of the per-sample differential
+
+    while (true) {
+        for (; summed < collected; summed++) {
+            float d = (float)(convertRaw(samples1[summed], pin1, atten) - convertRaw(samples2[summed], pin2, atten));
+            float delta = d - mean;
+            mean += delta / (summed + 1);
+            m2 += delta * (d - mean);
+        }
+        if (collected >= ADAPTIVE_MIN_SAMPLES) {
+            float standardError = sqrtf(m2 / (collected - 1) / collected);
+            float halfWidth = ADAPTIVE_Z * standardError + ADAPTIVE_MARGIN_MV;
+            float value = trimmedDifferential(pin1, pin2, collected, atten);
+            if (intervalClearOfThresholds(value - halfWidth, value + halfWidth, thresholds, count)) {
+                break;
+            }
+        }
+        if (collected >= max_samples) {
+            break;
+        }
+        int block = max_samples - collected;
+        if (block > ADAPTIVE_BLOCK_SAMPLES) {
+            block = ADAPTIVE_BLOCK_SAMPLES;
+        }
+        int got = acquireSamples(pin1, pin2, block, collected);
+        if (got <= 0) {
+            break;
+        }
+        collected += got;
+    }
+    if (atten != ADC_ATTEN_DB_11) {
+        setRange(pin1, pin2, ADC_ATTEN_DB_11);
+    }
+    if (collected == 0) {
+        return result;
+    }
+    sampledPairs++;
+    sampledSamples += collected;
+
+    result.mean = trimmedDifferential(pin1, pin2, collected, atten);
+    result.spread = collected > 1 ? (int)lroundf(sqrtf(m2 / (collected - 1))) : 0;
+    result.samples = collected;
+    return result;
+}
+
+// The usual sample counts get a kernel specialised at compile time
+int robustChannelMean(const int* samples, int nr_samples) {
+    switch (nr_samples) {
+        case NUM_ADC_SAMPLES:
+            return RobustEstimator<NUM_ADC_SAMPLES>::trimmedMean(samples);
+        case MAX_NUM_ADC_SAMPLES:
+            return RobustEstimator<MAX_NUM_ADC_SAMPLES>::trimmedMean(samples);
+        default:
+            return RobustEstimator<MAX_NUM_ADC_SAMPLES>::trimmedMean(samples, nr_samples);
+    }
+}
+
+// Fills in mean, spread and samples from the first nr_samples entries of samples1/samples2
+void summarizeSamples(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples, MeasurementResult& result,
+                      adc_atten_t atten = ADC_ATTEN_DB_11) {
+    sampledPairs++;
+    sampledSamples += nr_samples;
+    result.samples = nr_samples;
+    if (nr_samples <= 0) {
+        return;
+    }
+
+    // Trimmed mean (10% from each end), each channel trimmed on its own values
+    result.mean = trimmedDifferential(pin1, pin2, nr_samples, atten);
+
+    // Spread of the per-sample differential, untrimmed so spikes do show up in it
+    float mean = 0.0f;
+    float m2 = 0.0f;
+    for (int i = 0; i < nr_samples; i++) {
+        float d = (float)(convertRaw(samples1[i], pin1, atten) - convertRaw(samples2[i], pin2, atten));
+        float delta = d - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (d - mean);
+    }
+    result.spread = nr_samples > 1 ? (int)lroundf(sqrtf(m2 / (nr_samples - 1))) : 0;
+}
+
+// Always spends the full sample budget of its range
+MeasurementResult measureDifferentialFixed(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    MeasurementResult result = {0, 0, 0, esp_timer_get_time()};
+    adc_atten_t atten;
+    int probed = probeRange(pin1, pin2, nr_samples, atten);
+    // Collect the rest of the samples from each pin
+    nr_samples = probed + acquireSamples(pin1, pin2, nr_samples - probed, probed);
+    if (atten != ADC_ATTEN_DB_11) {
+        setRange(pin1, pin2, ADC_ATTEN_DB_11);
+    }
+    summarizeSamples(pin1, pin2, nr_samples, result, atten);
+    return result;
+}
+
+// A symmetric trim keeps the cancellation: evenly spaced samples of a sine come in +/- pairs
+MeasurementResult measureDifferentialMainsSync(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    MeasurementResult result = {0, 0, 0, esp_timer_get_time()};
+    nr_samples = acquireSamplesMainsSync(pin1, pin2, nr_samples);
+    summarizeSamples(pin1, pin2, nr_samples, result);
+    return result;
+}
+
+MeasurementResult measureDifferential(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    if (mainsSyncActive()) {
+        return measureDifferentialMainsSync(pin1, pin2, nr_samples);
+    }
+    if (adaptiveSampling && activeThresholdCount > 0) {
+        return measureDifferentialAdaptive(pin1, pin2, nr_samples, activeThresholds, activeThresholdCount);
+    }
+    return measureDifferentialFixed(pin1, pin2, nr_samples);
+}
+
+int getDifferentialSampleFixed(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    return measureDifferentialFixed(pin1, pin2, nr_samples).mean;
+}
+
+int getDifferentialSample(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples) {
+    return measureDifferential(pin1, pin2, nr_samples).mean;
 }
 
 // Debug version to understand what's happening
@@ -163,29 +487,9 @@ int getDifferentialSampleDebug(adc1_channel_t pin1, adc1_channel_t pin2) {
         samples2[i] = adc1_get_raw(pin2);
     }
 
-    // Simple insertion sort for NUM_ADC_SAMPLES elements (very fast)
-    for (int i = 1; i < NUM_ADC_SAMPLES; i++) {
-        int key1 = samples1[i];
-        int key2 = samples2[i];
-        int j = i - 1;
-        while (j >= 0 && samples1[j] > key1) {
-            samples1[j + 1] = samples1[j];
-            samples2[j + 1] = samples2[j];
-            j--;
-        }
-        samples1[j + 1] = key1;
-        samples2[j + 1] = key2;
-    }
-
     // Use proper median values
-    int median1, median2;
-    if (NUM_ADC_SAMPLES % 2 == 0) {
-        median1 = (samples1[NUM_ADC_SAMPLES / 2 - 1] + samples1[NUM_ADC_SAMPLES / 2]) / 2;
-        median2 = (samples2[NUM_ADC_SAMPLES / 2 - 1] + samples2[NUM_ADC_SAMPLES / 2]) / 2;
-    } else {
-        median1 = samples1[NUM_ADC_SAMPLES / 2];
-        median2 = samples2[NUM_ADC_SAMPLES / 2];
-    }
+    int median1 = RobustEstimator<NUM_ADC_SAMPLES>::median(samples1);
+    int median2 = RobustEstimator<NUM_ADC_SAMPLES>::median(samples2);
 
     int voltage1 = getCalibratedVoltage(median1, pin1);
     int voltage2 = getCalibratedVoltage(median2, pin2);
@@ -204,7 +508,7 @@ extern const int Reference_3_Ohm[] = {3 * 16, 3 * 16, 3 * 16};
 extern const int Reference_5_Ohm[] = {5 * 16, 5 * 16, 5 * 16};
 extern const int Reference_10_Ohm[] = {10 * 16, 10 * 16, 10 * 16};
 
-uint8_t testsettings[][3][2] = {
+constexpr uint8_t testsettings[][3][2] = {
     {{IODirection_cr_cl, IOValues_cr_cl},
      {IODirection_cr_piste, IOValues_cr_piste},
      {IODirection_cr_bl, IOValues_cr_bl}},
@@ -216,19 +520,256 @@ uint8_t testsettings[][3][2] = {
      {IODirection_br_bl, IOValues_br_bl}},
 
 };
+
+// Indexed by Pair_t, evaluated at compile time
+constexpr DrivePattern drivePatterns[NUM_PAIRS] = {
+    makeDrivePattern(testsettings[0][0][0], testsettings[0][0][1]),
+    makeDrivePattern(testsettings[0][1][0], testsettings[0][1][1]),
+    makeDrivePattern(testsettings[0][2][0], testsettings[0][2][1]),
+    makeDrivePattern(testsettings[1][0][0], testsettings[1][0][1]),
+    makeDrivePattern(testsettings[1][1][0], testsettings[1][1][1]),
+    makeDrivePattern(testsettings[1][2][0], testsettings[1][2][1]),
+    makeDrivePattern(testsettings[2][0][0], testsettings[2][0][1]),
+    makeDrivePattern(testsettings[2][1][0], testsettings[2][1][1]),
+    makeDrivePattern(testsettings[2][2][0], testsettings[2][2][1]),
+    makeDrivePattern(IODirection_ar_br, IOValues_ar_br),
+    makeDrivePattern(IODirection_ar_cr, IOValues_ar_cr),
+    makeDrivePattern(IODirection_br_cr, IOValues_br_cr),
+    makeDrivePattern(IODirection_cl_piste, IOValues_cl_piste),
+};
+
+// Dead time after switching to a pattern, filled by characterizeSettling() or loaded from NVS
+uint16_t settleTimeUs[NUM_PAIRS] = {0};
+
+void applyDrivePattern(Pair_t pair) {
+    applyDrivePattern(drivePatterns[pair]);
+    if (settleTimeUs[pair]) {
+        delayMicroseconds(settleTimeUs[pair]);
+    }
+}
+
+// Driven (right) and sensed (left) channel of each pair, indexed by Pair_t
+struct PairChannels {
+    adc1_channel_t pin1;
+    adc1_channel_t pin2;
+};
+constexpr PairChannels pairChannels[NUM_PAIRS] = {
+    {cr_analog, cl_analog}, {cr_analog, piste_analog}, {cr_analog, bl_analog},
+    {ar_analog, cl_analog}, {ar_analog, piste_analog}, {ar_analog, bl_analog},
+    {br_analog, cl_analog}, {br_analog, piste_analog}, {br_analog, bl_analog},
+    {ar_analog, br_analog}, {ar_analog, cr_analog},    {br_analog, cr_analog},
+    {cl_analog, piste_analog},
+};
+
+MeasurementResult measurePair(Pair_t pair, int nr_samples) {
+    applyDrivePattern(pair);
+    return measureDifferential(pairChannels[pair].pin1, pairChannels[pair].pin2, nr_samples);
+}
+
+// Live tracking: a few fresh samples per call, filtered per pair across calls
+constexpr int TRACK_SAMPLES = 4;
+constexpr float TRACK_PROCESS_NOISE_MV = 2.0f;
+constexpr float TRACK_MEASUREMENT_NOISE_MV = 8.0f;  // Median of TRACK_SAMPLES differential samples
+constexpr float TRACK_STEP_SIGMAS = 4.0f;
+constexpr float TRACK_STEP_MIN_MV = 30.0f;
+
+bool pairTracking = false;
+ScalarKalman pairTrackers[NUM_PAIRS];
+bool trackLowRange[NUM_PAIRS];  // The pair's last tracked reading fitted the 6 dB range
+
+void setPairTracking(bool enabled) {
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        pairTrackers[i].configure(TRACK_PROCESS_NOISE_MV, TRACK_MEASUREMENT_NOISE_MV, TRACK_STEP_SIGMAS,
+                                  TRACK_STEP_MIN_MV);
+    }
+    pairTracking = enabled;
+}
+
+bool isPairTracking() { return pairTracking; }
+
+void resetPairTrackers() {
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        pairTrackers[i].reset();
+    }
+}
+
+int trackPair(Pair_t pair) {
+    int diff[TRACK_SAMPLES];
+    adc1_channel_t pin1 = pairChannels[pair].pin1;
+    adc1_channel_t pin2 = pairChannels[pair].pin2;
+    applyDrivePattern(pair);
+    bool mainsSync = mainsSyncActive();
+    // Too few samples to probe the range first: the range follows the previous call, and a 6 dB read that went
+    // over the range is taken again at 11 dB
+    adc_atten_t atten = !mainsSync && autoRangeActive() && trackLowRange[pair] ? ADC_ATTEN_DB_6 : ADC_ATTEN_DB_11;
+    if (atten != ADC_ATTEN_DB_11) {
+        setRange(pin1, pin2, atten);
+    }
+    int got =
+        mainsSync ? acquireSamplesMainsSync(pin1, pin2, TRACK_SAMPLES) : acquireSamples(pin1, pin2, TRACK_SAMPLES);
+    if (atten != ADC_ATTEN_DB_11) {
+        setRange(pin1, pin2, ADC_ATTEN_DB_11);
+        if (!fitsLowRange(pin1, pin2, 0, got, atten)) {
+            sampledSamples += got;
+            atten = ADC_ATTEN_DB_11;
+            got = acquireSamples(pin1, pin2, TRACK_SAMPLES);
+        }
+    }
+    trackLowRange[pair] = !mainsSync && autoRangeActive() && got > 0 && fitsLowRange(pin1, pin2, 0, got, atten);
+    for (int i = 0; i < got; i++) {
+        diff[i] = convertRaw(samples1[i], pin1, atten) - convertRaw(samples2[i], pin2, atten);
+    }
+    sampledPairs++;
+    sampledSamples += got;
+    if (got > 0) {
+        // The median keeps a single ADC spike from looking like a step. Over a mains period only the mean
+        // cancels the hum, the samples then come in +/- pairs that the median would not balance.
+        pairTrackers[pair].update(mainsSync ? RobustEstimator<TRACK_SAMPLES>::trimmedMean(diff, got, 0)
+                                            : RobustEstimator<TRACK_SAMPLES>::median(diff, got));
+    }
+    return (int)lroundf(pairTrackers[pair].value());
+}
+
 adc1_channel_t analogtestsettings[3] = {cl_analog, piste_analog, bl_analog};
 adc1_channel_t analogtestsettings_right[3] = {cr_analog, ar_analog, br_analog};
 
-void testWiresOnByOne() {
+// Measurement cache: the testXxXx functions reuse a reading of the same pair taken less than cacheMaxAgeUs ago.
+// Every single-pair measurement fills it, scans included. A new epoch drops all entries at once.
+struct CachedReading {
+    int value;
+    int64_t timestampUs;
+    uint32_t epoch;
+};
+CachedReading measurementCache[NUM_PAIRS];
+uint32_t cacheEpoch = 1;  // Entries start at epoch 0, so invalid
+int cacheMaxAgeUs = 0;
+
+void setMeasurementCacheMaxAge(int maxAgeUs) { cacheMaxAgeUs = maxAgeUs < 0 ? 0 : maxAgeUs; }
+
+int getMeasurementCacheMaxAge() { return cacheMaxAgeUs; }
+
+void invalidateMeasurementCache() { cacheEpoch++; }
+
+int measurePairSample(Pair_t pair) {
+    applyDrivePattern(pair);
+    int value = getDifferentialSample(pairChannels[pair].pin1, pairChannels[pair].pin2);
+    measurementCache[pair] = {value, esp_timer_get_time(), cacheEpoch};
+    return value;
+}
+
+int testPairCached(Pair_t pair) {
+    const CachedReading& cached = measurementCache[pair];
+    if (cacheMaxAgeUs > 0 && cached.epoch == cacheEpoch && esp_timer_get_time() - cached.timestampUs < cacheMaxAgeUs) {
+        return cached.value;
+    }
+    return measurePairSample(pair);
+}
+
+void measureMatrixEntry(int entry) { measurements[entry / 3][entry % 3] = measurePairSample((Pair_t)entry); }
+
+// One pattern per row: the row's right-side pin driven high, all three left-side pins low.
+// A set direction bit is an input, so AND-ing the row's pair settings makes every pin they drive an output.
+constexpr uint8_t rowDirection(int Nr) {
+    return testsettings[Nr][0][0] & testsettings[Nr][1][0] & testsettings[Nr][2][0];
+}
+constexpr DrivePattern rowPatterns[3] = {
+    makeDrivePattern(rowDirection(0), testsettings[0][0][1]),
+    makeDrivePattern(rowDirection(1), testsettings[1][0][1]),
+    makeDrivePattern(rowDirection(2), testsettings[2][0][1]),
+};
+
+// Below this a left-side wire is taken as connected to the driven pin. A single connection leaves the other
+// entries of the row at half the supply or more, so this cannot be reached without a second connection.
+constexpr int MUX_SHARED_THRESHOLD_MV = 1200;
+
+bool multiplexedScan = false;
+
+void setMultiplexedScan(bool enabled) { multiplexedScan = enabled; }
+
+bool isMultiplexedScan() { return multiplexedScan; }
+
+void applyRowPattern(int Nr) {
+    applyDrivePattern(rowPatterns[Nr]);
+    int settle = 0;
+    for (int j = 0; j < 3; j++) {
+        if (settleTimeUs[Nr * 3 + j] > settle) {
+            settle = settleTimeUs[Nr * 3 + j];
+        }
+    }
+    if (settle) {
+        delayMicroseconds(settle);
+    }
+}
+
+void testWiresRowByRow() {
     for (int Nr = 0; Nr < 3; Nr++) {
+        applyRowPattern(Nr);
+        int connected = 0;
         for (int j = 0; j < 3; j++) {
-            Set_IODirectionAndValue(testsettings[Nr][j][0], testsettings[Nr][j][1]);
             measurements[Nr][j] = getDifferentialSample(analogtestsettings_right[Nr], analogtestsettings[j]);
+            if (measurements[Nr][j] < MUX_SHARED_THRESHOLD_MV) {
+                connected++;
+            }
+        }
+        // Several connections share the drive current, so the readings no longer match the per-pair ones
+        if (connected > 1) {
+            for (int j = 0; j < 3; j++) {
+                measureMatrixEntry(Nr * 3 + j);
+            }
+        }
+    }
+}
+
+const Pair_t* scanOrder = SCAN_ORDER_MIN_SWITCHING;
+
+void setScanOrder(const Pair_t* order) { scanOrder = order; }
+
+void testWiresOnByOne() {
+    if (multiplexedScan) {
+        testWiresRowByRow();
+    } else {
+        for (int i = 0; i < 9; i++) {
+            measureMatrixEntry(scanOrder[i]);
         }
     }
+    measurementSnapshot().publish(measurements);
     return;
 }
 
+ScanSchedule activeSchedule = SCAN_FULL;
+int coldCursor = 0;
+
+ScanSchedule getScanSchedule() { return activeSchedule; }
+
+void setScanSchedule(const ScanSchedule& schedule) {
+    activeSchedule = schedule;
+    coldCursor = 0;
+}
+
+void scanScheduled() {
+    if (activeSchedule.hotMask == SCAN_ALL) {
+        testWiresOnByOne();
+        return;
+    }
+    for (int entry = 0; entry < 9; entry++) {
+        if (activeSchedule.hotMask & (1 << entry)) {
+            measureMatrixEntry(entry);
+        }
+    }
+    if (!(activeSchedule.coldMask & SCAN_ALL)) {
+        measurementSnapshot().publish(measurements);
+        return;
+    }
+    for (int done = 0; done < activeSchedule.coldPerScan;) {
+        coldCursor = (coldCursor + 1) % 9;
+        if (activeSchedule.coldMask & (1 << coldCursor)) {
+            measureMatrixEntry(coldCursor);
+            done++;
+        }
+    }
+    measurementSnapshot().publish(measurements);
+}
+
 bool WirePluggedIn(int threashold) {
     for (int Nr = 0; Nr < 3; Nr++) {
         for (int j = 0; j < 3; j++) {
@@ -288,9 +829,9 @@ bool testStraightOnly(int threashold) {
     bool bOK = true;
     for (int Nr = 0; Nr < 3; Nr++) {
         {
-            Set_IODirectionAndValue(testsettings[Nr][Nr][0], testsettings[Nr][Nr][1]);
+            applyDrivePattern((Pair_t)(Nr * 3 + Nr));
             measurements[Nr][Nr] =
-                getDifferentialSample(analogtestsettings_right[Nr], analogtestsettings[Nr], MAX_NUM_ADC_SAMPLES);
+                getDifferentialSampleFixed(analogtestsettings_right[Nr], analogtestsettings[Nr], MAX_NUM_ADC_SAMPLES);
             if (measurements[Nr][Nr] > threashold)
                 bOK = false;
         }
@@ -299,39 +840,105 @@ bool testStraightOnly(int threashold) {
     return bOK;
 }
 
-int testArBr() {
-    Set_IODirectionAndValue(IODirection_ar_br, IOValues_ar_br);
-    return (getDifferentialSample(ar_analog, br_analog));
-}
-int testArCr() {
-    Set_IODirectionAndValue(IODirection_ar_cr, IOValues_ar_cr);
-    return (getDifferentialSample(ar_analog, cr_analog));
-}
-int testArCl() {
-    Set_IODirectionAndValue(IODirection_ar_cl, IOValues_ar_cl);
-    return (getDifferentialSample(ar_analog, cl_analog));
-}
+int testArBr() { return testPairCached(PAIR_AR_BR); }
+int testArCr() { return testPairCached(PAIR_AR_CR); }
+int testArCl() { return testPairCached(PAIR_AR_CL); }
+
+int testBrCr() { return testPairCached(PAIR_BR_CR); }
+
+int testBrCl() { return testPairCached(PAIR_BR_CL); }
 
-int testBrCr() {
-    Set_IODirectionAndValue(IODirection_br_cr, IOValues_br_cr);
-    return (getDifferentialSample(br_analog, cr_analog));
+int testCrCl() { return testPairCached(PAIR_CR_CL); }
+
+int testAlBl() { return testPairCached(PAIR_CL_PISTE); }
+
+// In the order scan_order_analysis.cpp assumes around the scan: ArCr right after it, ClPiste (testAlBl) last
+constexpr Pair_t CROSS_PAIR_ORDER[NUM_CROSS_PAIRS] = {PAIR_AR_CR, PAIR_AR_BR, PAIR_BR_CR, PAIR_CL_PISTE};
+int crossMeasurements[NUM_CROSS_PAIRS];
+
+void testCrossPairs() {
+    for (Pair_t pair : CROSS_PAIR_ORDER) {
+        crossMeasurements[pair - PAIR_AR_BR] = measurePairSample(pair);
+    }
 }
 
-int testBrCl() {
-    Set_IODirectionAndValue(IODirection_br_cl, IOValues_br_cl);
-    return (getDifferentialSample(br_analog, cl_analog));
+int pairMeasurement(Pair_t pair) {
+    return pair < PAIR_AR_BR ? measurements[pair / 3][pair % 3] : crossMeasurements[pair - PAIR_AR_BR];
 }
 
-int testCrCl() {
-    Set_IODirectionAndValue(IODirection_cr_cl, IOValues_cr_cl);
-    return (getDifferentialSample(cr_analog, cl_analog));
+// Presence probe: every driver except al is an output, so one pattern puts a voltage across many pairs at once.
+// Right side high against left side low catches any wire, ar and cl high catches the ArBr and ArCr shorts and the
+// reel (ClPiste), br high against cr the lame (BrCr). Only the node voltages are compared, no differentials.
+constexpr uint8_t PRESENCE_DIRECTION = 129;  // al (and the unused bit 7) stays an input
+constexpr int PRESENCE_SAMPLES = 4;
+constexpr int PRESENCE_DELTA_MV = 100;
+
+const DrivePattern presencePatterns[3] = {
+    makeDrivePattern(PRESENCE_DIRECTION, 56),  // ar, br, cr high
+    makeDrivePattern(PRESENCE_DIRECTION, 12),  // ar, cl high
+    makeDrivePattern(PRESENCE_DIRECTION, 16),  // br high
+};
+
+struct PresenceRead {
+    int pattern;
+    adc1_channel_t pin1;
+    adc1_channel_t pin2;
+};
+
+const PresenceRead presenceReads[] = {
+    {0, cr_analog, ar_analog},
+    {0, br_analog, piste_analog},
+    {1, ar_analog, cl_analog},
+    {2, br_analog, cr_analog},
+};
+constexpr int NUM_PRESENCE_READS = sizeof(presenceReads) / sizeof(presenceReads[0]);
+
+int presenceReference[NUM_PRESENCE_READS][2];
+bool presenceReferenceValid = false;
+int64_t presenceReferenceUs = 0;
+
+int meanMilliVolts(const int* samples, int nr_samples) {
+    long sum = 0;
+    for (int i = 0; i < nr_samples; i++) {
+        sum += samples[i];
+    }
+    return adcRawToMilliVolts(sum / nr_samples);
 }
 
-int testAlBl() {
-    Set_IODirectionAndValue(IODirection_cl_piste, IOValues_cl_piste);
-    return (getDifferentialSample(cl_analog, piste_analog));
+bool presenceChanged(int maxAgeMs) {
+    // The patterns drive more pins than any pair, so wait as long as the slowest characterized pair
+    int settleUs = 0;
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        settleUs = settleTimeUs[i] > settleUs ? settleTimeUs[i] : settleUs;
+    }
+
+    int nodes[NUM_PRESENCE_READS][2];
+    for (int i = 0; i < NUM_PRESENCE_READS; i++) {
+        if (i == 0 || presenceReads[i].pattern != presenceReads[i - 1].pattern) {
+            applyDrivePattern(presencePatterns[presenceReads[i].pattern]);
+            delayMicroseconds(settleUs);
+        }
+        int got = acquireSamples(presenceReads[i].pin1, presenceReads[i].pin2, PRESENCE_SAMPLES);
+        nodes[i][0] = meanMilliVolts(samples1, got);
+        nodes[i][1] = meanMilliVolts(samples2, got);
+    }
+
+    int64_t now = esp_timer_get_time();
+    bool changed = !presenceReferenceValid || now - presenceReferenceUs > (int64_t)maxAgeMs * 1000;
+    for (int i = 0; i < NUM_PRESENCE_READS && !changed; i++) {
+        changed = abs(nodes[i][0] - presenceReference[i][0]) > PRESENCE_DELTA_MV ||
+                  abs(nodes[i][1] - presenceReference[i][1]) > PRESENCE_DELTA_MV;
+    }
+    if (changed) {
+        memcpy(presenceReference, nodes, sizeof(nodes));
+        presenceReferenceValid = true;
+        presenceReferenceUs = now;
+    }
+    return changed;
 }
 
+void resetPresenceProbe() { presenceReferenceValid = false; }
+
 // Simply broken: no contact between i-i' and no contact with other wires
 bool IsBroken(int Nr, int threashold) {
     if ((measurements[Nr][Nr] < threashold))
@@ -351,16 +958,26 @@ bool IsSwappedWith(int i, int j, int threashold) {
     return false;
 }
 
+// The loop current is set by R1 + R2 and the wire under test, not by the drive capability, which only sets the
+// output resistance of the pin and how hard its edges are. The reduced one softens the edges when the
+// high-resistance tests (reel, lame) switch patterns, and with them the ground bounce on the ADC. Its higher output
+// resistance is a few ohms in series with the loop, which is why it needs its own calibration.
+const gpio_drive_cap_t driveCapability[NUM_DRIVE_STRENGTHS] = {GPIO_DRIVE_CAP_3, GPIO_DRIVE_CAP_2};  // 40, 20 mA
+DriveStrength_t driveStrength = DRIVE_STRONG;
+
+void setDriveStrength(DriveStrength_t strength) {
+    for (int i = 0; i < 7; i++) {
+        gpio_set_drive_capability((gpio_num_t)DRIVER_PINS[i], driveCapability[strength]);
+    }
+    driveStrength = strength;
+    invalidateMeasurementCache();
+}
+
+DriveStrength_t getDriveStrength() { return driveStrength; }
+
 void init_AD() {
-    gpio_set_drive_capability(GPIO_NUM_33, GPIO_DRIVE_CAP_3);  // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_21, GPIO_DRIVE_CAP_3);  // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_23, GPIO_DRIVE_CAP_3);  // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_25, GPIO_DRIVE_CAP_3);  // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_5, GPIO_DRIVE_CAP_3);   // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_18, GPIO_DRIVE_CAP_3);  // 40 mA
-    gpio_set_drive_capability(GPIO_NUM_19, GPIO_DRIVE_CAP_3);  // 40 mA
-
-    Set_IODirectionAndValue(IODirection_ar_bl, IOValues_ar_bl);
+    setDriveStrength(DRIVE_STRONG);
+
     adc1_config_width(ADC_WIDTH_BIT_12);
     adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_11);
     adc1_config_channel_atten(ADC1_CHANNEL_3, ADC_ATTEN_DB_11);
@@ -370,6 +987,12 @@ void init_AD() {
     adc1_config_channel_atten(ADC1_CHANNEL_7, ADC_ATTEN_DB_11);
 
     esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &adc_chars);
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_6, ADC_WIDTH_BIT_12, 1100, &adc_chars_db6);
+    buildAdcLookupTables();
+
+    // Configure the driver pins once through pinMode, after the ADC setup so they end up routed
+    // through the GPIO matrix. From here on patterns are switched with direct register writes.
+    Set_IODirectionAndValueLegacy(IODirection_ar_bl, IOValues_ar_bl);
 
     // Warm up ADC with some dummy readings
     int test = adc1_get_raw(ADC1_CHANNEL_3);
@@ -390,6 +1013,171 @@ void init_AD() {
 // Remove the entire calibrateADCOffsets() function (100+ lines)
 
 // Simplify getCalibratedVoltage to just return uncalibrated voltage:
-int getCalibratedVoltage(int raw_value, adc1_channel_t channel) {
-    return esp_adc_cal_raw_to_voltage(raw_value, &adc_chars);
-}
\ No newline at end of file
+int getCalibratedVoltage(int raw_value, adc1_channel_t channel) { return adcRawToMilliVolts(raw_value); }
+
+int adcRawToMilliVolts(int raw) {
+    if (raw < 0) {
+        raw = 0;
+    } else if (raw >= ADC_RAW_RANGE) {
+        raw = ADC_RAW_RANGE - 1;
+    }
+    if (!adcLookupTablesBuilt) {
+        return esp_adc_cal_raw_to_voltage(raw, &adc_chars);
+    }
+    return rawToMilliVolts[raw];
+}
+
+int adcRawToMilliVoltsDb6(int raw) {
+    if (raw < 0) {
+        raw = 0;
+    } else if (raw >= ADC_RAW_RANGE) {
+        raw = ADC_RAW_RANGE - 1;
+    }
+    if (!adcLookupTablesBuilt) {
+        return esp_adc_cal_raw_to_voltage(raw, &adc_chars_db6);
+    }
+    return rawToMilliVoltsDb6[raw];
+}
+
+int adcMilliVoltsToRaw(int milliVolts) {
+    if (milliVolts <= 0) {
+        return 0;
+    }
+    if (milliVolts > ADC_MV_RANGE) {
+        milliVolts = ADC_MV_RANGE;
+    }
+    return milliVoltsToRaw[milliVolts];
+}
+
+bool adcLookupTablesReady() { return adcLookupTablesBuilt; }
+
+// Settling characterization: switch from every other pattern to `to` and record the differential reading
+// sample by sample. The step has settled once every later reading stays within the noise band of the
+// final value; the dead time is the worst case over all source patterns and repetitions.
+constexpr int SETTLE_SAMPLES = 64;
+constexpr int SETTLE_TAIL = 16;  // Last samples, taken as the settled value
+constexpr int SETTLE_REPEATS = 4;
+constexpr int SETTLE_TOLERANCE_MV = 10;
+constexpr int SETTLE_SAFETY_PERCENT = 25;
+constexpr int SETTLE_MAX_US = 1000;
+constexpr int SETTLE_NVS_VERSION = 1;
+
+int measureSettleTimeUs(Pair_t from, Pair_t to) {
+    int diff[SETTLE_SAMPLES];
+    int64_t time[SETTLE_SAMPLES];
+    adc1_channel_t pin1 = pairChannels[to].pin1;
+    adc1_channel_t pin2 = pairChannels[to].pin2;
+
+    applyDrivePattern(drivePatterns[from]);
+    delayMicroseconds(SETTLE_MAX_US);
+    applyDrivePattern(drivePatterns[to]);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < SETTLE_SAMPLES; i++) {
+        time[i] = esp_timer_get_time() - start;
+        diff[i] = adcRawToMilliVolts(adc1_get_raw(pin1)) - adcRawToMilliVolts(adc1_get_raw(pin2));
+    }
+
+    const int* tail = diff + SETTLE_SAMPLES - SETTLE_TAIL;
+    int settled = RobustEstimator<SETTLE_TAIL>::median(tail);
+    int deviation[SETTLE_TAIL];
+    for (int i = 0; i < SETTLE_TAIL; i++) {
+        deviation[i] = abs(tail[i] - settled);
+    }
+    // Three median absolute deviations, but never tighter than the ADC noise floor
+    int tolerance = 3 * RobustEstimator<SETTLE_TAIL>::median(deviation);
+    if (tolerance < SETTLE_TOLERANCE_MV) {
+        tolerance = SETTLE_TOLERANCE_MV;
+    }
+
+    int last = SETTLE_SAMPLES - SETTLE_TAIL - 1;
+    while (last >= 0 && abs(diff[last] - settled) <= tolerance) {
+        last--;
+    }
+    if (last < 0) {
+        return 0;
+    }
+    if (last == SETTLE_SAMPLES - SETTLE_TAIL - 1) {
+        return SETTLE_MAX_US;  // Still moving at the end of the window
+    }
+    return time[last + 1];
+}
+
+void characterizeSettling() {
+    bool streamWasRunning = adcStream().isRunning();
+    adcStream().end();
+
+    for (int to = 0; to < NUM_PAIRS; to++) {
+        int worst = 0;
+        for (int from = 0; from < NUM_PAIRS; from++) {
+            if (from == to) {
+                continue;
+            }
+            for (int r = 0; r < SETTLE_REPEATS; r++) {
+                esp_task_wdt_reset();
+                int us = measureSettleTimeUs((Pair_t)from, (Pair_t)to);
+                if (us > worst) {
+                    worst = us;
+                }
+            }
+        }
+        worst = worst * (100 + SETTLE_SAFETY_PERCENT) / 100;
+        settleTimeUs[to] = worst > SETTLE_MAX_US ? SETTLE_MAX_US : worst;
+    }
+
+    if (streamWasRunning) {
+        adcStream().begin();
+    }
+}
+
+int getSettleTimeUs(Pair_t pair) { return settleTimeUs[pair]; }
+
+void clearSettleTimes() {
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        settleTimeUs[i] = 0;
+    }
+}
+
+bool saveSettleTimesToNvs(const char* nvs_namespace) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nvs_namespace, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        printf("Failed to open NVS namespace '%s' for writing: %s\n", nvs_namespace, esp_err_to_name(err));
+        return false;
+    }
+    int version = SETTLE_NVS_VERSION;
+    err |= nvs_set_blob(handle, "dead_us", settleTimeUs, sizeof(settleTimeUs));
+    err |= nvs_set_blob(handle, "Version", &version, sizeof(int));
+    err |= nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        printf("Failed to save settle times to NVS: %s\n", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool loadSettleTimesFromNvs(const char* nvs_namespace) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nvs_namespace, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return false;
+    }
+    int version = 0;
+    size_t required_size = sizeof(int);
+    uint16_t loaded[NUM_PAIRS];
+    err = nvs_get_blob(handle, "Version", &version, &required_size);
+    if (err == ESP_OK) {
+        // The size check also rejects a table saved for a different set of patterns
+        required_size = sizeof(loaded);
+        err = nvs_get_blob(handle, "dead_us", loaded, &required_size);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK || version != SETTLE_NVS_VERSION || required_size != sizeof(loaded)) {
+        printf("No usable settle times in NVS, switching patterns without dead time\n");
+        return false;
+    }
+    for (int i = 0; i < NUM_PAIRS; i++) {
+        settleTimeUs[i] = loaded[i] > SETTLE_MAX_US ? SETTLE_MAX_US : loaded[i];
+    }
+    return true;
+}
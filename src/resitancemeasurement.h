@@ -4,9 +4,49 @@
 #include <Arduino.h>
 
 #include "Hardware.h"
+#include "MeasurementPairs.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
 
+// Number of ADC samples to take for each measurement
+constexpr int MAX_NUM_ADC_SAMPLES = 64;
+#define NUM_ADC_SAMPLES 16
+
+// Register masks for one IODirection/IOValues combination of the 7 driver pins.
+// GPIO0-31 are controlled through GPIO_OUT/GPIO_ENABLE, GPIO32-39 through GPIO_OUT1/GPIO_ENABLE1.
+struct DrivePattern {
+    uint32_t out_set;
+    uint32_t out_clear;
+    uint32_t enable_set;
+    uint32_t enable_clear;
+    uint32_t out1_set;
+    uint32_t out1_clear;
+    uint32_t enable1_set;
+    uint32_t enable1_clear;
+};
+
+// Same bit order as the IODirection_*/IOValues_* defines
+constexpr uint8_t DRIVER_PINS[7] = {al_driver, bl_driver, cl_driver, ar_driver, br_driver, cr_driver, piste_driver};
+
+// Register mask of the driver pins selected by `bits`, restricted to the low (GPIO0-31) or high bank
+constexpr uint32_t driverPinMask(uint8_t bits, bool highBank, int i = 0) {
+    return i >= 7 ? 0u
+                  : ((((bits >> i) & 1) && ((DRIVER_PINS[i] >= 32) == highBank)) ? (1u << (DRIVER_PINS[i] & 31)) : 0u) |
+                        driverPinMask(bits, highBank, i + 1);
+}
+
+// A set bit in `setting` makes the pin an input, a cleared bit an output driven to the matching bit in `values`
+constexpr DrivePattern makeDrivePattern(uint8_t setting, uint8_t values) {
+    return DrivePattern{driverPinMask(uint8_t(~setting & values), false),
+                        driverPinMask(uint8_t(~setting & ~values), false),
+                        driverPinMask(uint8_t(~setting), false),
+                        driverPinMask(setting, false),
+                        driverPinMask(uint8_t(~setting & values), true),
+                        driverPinMask(uint8_t(~setting & ~values), true),
+                        driverPinMask(uint8_t(~setting), true),
+                        driverPinMask(setting, true)};
+}
+
 // Global variables (extern declarations)
 extern int measurements[3][3];
 extern const uint8_t driverpins[7];
@@ -16,12 +56,110 @@ extern const int Reference_10_Ohm[3];
 
 // Function prototypes
 void Set_IODirectionAndValue(uint8_t setting, uint8_t values);
+void Set_IODirectionAndValueLegacy(uint8_t setting, uint8_t values);
+void applyDrivePattern(const DrivePattern& pattern);
+void applyDrivePattern(Pair_t pair);  // Includes the pattern's dead time
+
+// Per-pattern dead time between switching the drivers and the first sample. characterizeSettling()
+// measures the step response of every pattern and takes several seconds; run it with nothing plugged in, from the
+// tester task (Tester::runInTesterTask), since it stops the DMA stream and rewrites the dead times.
+void characterizeSettling();
+int getSettleTimeUs(Pair_t pair);
+void clearSettleTimes();
+bool saveSettleTimesToNvs(const char* nvs_namespace = "settle");
+bool loadSettleTimesFromNvs(const char* nvs_namespace = "settle");
+
+// Output strength of the driver pins. The driver's own output resistance is part of the calibration model
+// (its Correction/R term), so every strength needs its own calibration constants.
+typedef enum { DRIVE_STRONG, DRIVE_REDUCED, NUM_DRIVE_STRENGTHS } DriveStrength_t;
+void setDriveStrength(DriveStrength_t strength);
+DriveStrength_t getDriveStrength();
+int acquireSamples(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples, int offset = 0);
+// A differential reading with its quality. mean is what getDifferentialSample returns, spread the standard
+// deviation of the individual differential samples, both in mV.
+struct MeasurementResult {
+    int mean;
+    int spread;
+    int samples;  // Sample pairs used, 0 when the acquisition failed
+    int64_t timestampUs;
+
+    // Standard error of the mean, in mV
+    float standardError() const { return samples > 0 ? spread / sqrtf((float)samples) : INFINITY; }
+    // True when the reading is more than `sigmas` standard errors above or below the threshold
+    bool clearlyAbove(int threshold, float sigmas = 3.0f) const { return mean - sigmas * standardError() > threshold; }
+    bool clearlyBelow(int threshold, float sigmas = 3.0f) const { return mean + sigmas * standardError() < threshold; }
+};
+
+MeasurementResult measureDifferential(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples = NUM_ADC_SAMPLES);
+int getDifferentialSample(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples = NUM_ADC_SAMPLES);
+int getDifferentialSampleFixed(adc1_channel_t pin1, adc1_channel_t pin2, int nr_samples = NUM_ADC_SAMPLES);
+
+// Adaptive (sequential) sampling: getDifferentialSample stops early once the reading is clearly
+// on one side of every active threshold. The tester keeps the active thresholds up to date.
+void setAdaptiveSampling(bool enabled);
+bool isAdaptiveSampling();
+void setActiveThresholds(const int* thresholds, int count);
+float getAverageSamplesPerPair();
+void resetSamplingStats();
+
+// Mains-synchronous sampling: getDifferentialSample and trackPair spread their samples over one period of 50 or
+// 60 Hz so mains hum cancels out. 0 switches it off. Takes precedence over adaptive sampling, not used with the DMA
+// stream.
+bool setMainsFrequency(int hz);
+int getMainsFrequency();
+
+// Auto-ranging: when both nodes of a pair are low enough (a connected, low-resistance pair) the reading is
+// taken at 6 dB attenuation, with its own characterization and half the samples. Covers every polled reading:
+// getDifferentialSample, getDifferentialSampleFixed and trackPair. Not used with the DMA stream or
+// mains-synchronous sampling.
+void setAutoRanging(bool enabled);
+bool isAutoRanging();
+
+// Applies the pair's drive pattern and measures it, with the same sampling mode as getDifferentialSample
+MeasurementResult measurePair(Pair_t pair, int nr_samples = NUM_ADC_SAMPLES);
+
+// Live tracking for the continuous test modes: every call takes a few fresh samples and feeds them to a
+// per-pair Kalman filter, which restarts on a large step. The special modes read their pairs through it while
+// tracking is on. Reset the trackers when a mode starts so no stale state carries over.
+void setPairTracking(bool enabled);
+bool isPairTracking();
+void resetPairTrackers();
+int trackPair(Pair_t pair);
+
+// Partial scans, see ScanSchedule in MeasurementPairs.h
+void setScanSchedule(const ScanSchedule& schedule);
+ScanSchedule getScanSchedule();
+// One scan according to the active schedule, testWiresOnByOne() always does a full one
+void scanScheduled();
 void testWiresOnByOne();
+
+// Multiplexed full scans: one drive pattern per row with all left-side wires low, the three entries of the row
+// are read under it. Rows with more than one connection are measured again pair by pair.
+void setMultiplexedScan(bool enabled);
+bool isMultiplexedScan();
+
+// Order in which a per-pair full scan visits the 9 patterns. SCAN_ORDER_MIN_SWITCHING comes from
+// scan_order_analysis.cpp: fewest driver direction and level changes from testAlBl(), the last pattern of the
+// waiting loop, through the scan to testArCr(), the first pattern after it.
+constexpr Pair_t SCAN_ORDER_ROW_MAJOR[9] = {
+    PAIR_CR_CL, PAIR_CR_PISTE, PAIR_CR_BL, PAIR_AR_CL, PAIR_AR_PISTE, PAIR_AR_BL, PAIR_BR_CL, PAIR_BR_PISTE, PAIR_BR_BL,
+};
+constexpr Pair_t SCAN_ORDER_MIN_SWITCHING[9] = {
+    PAIR_AR_PISTE, PAIR_BR_PISTE, PAIR_BR_CL, PAIR_BR_BL, PAIR_AR_BL, PAIR_CR_BL, PAIR_CR_PISTE, PAIR_CR_CL, PAIR_AR_CL,
+};
+void setScanOrder(const Pair_t* order);
 bool WirePluggedIn(int threashold = 160);
 bool WirePluggedInFoil(int threashold = 160);
 bool WirePluggedInEpee(int threashold = 160);
 bool WirePluggedInLameTopTesting(int threashold = 160);
 bool testStraightOnly(int threashold = 160);
+// Measurement cache for the testXxXx functions: within maxAgeUs of a reading of the same pair (by a test
+// function or a scan) they return that reading instead of measuring again. 0, the default, disables it.
+// invalidateMeasurementCache() drops every entry, for when the readings change meaning.
+void setMeasurementCacheMaxAge(int maxAgeUs);
+int getMeasurementCacheMaxAge();
+void invalidateMeasurementCache();
+int testPairCached(Pair_t pair);
 int testArBr();
 int testArCr();
 int testArCl();
@@ -29,6 +167,23 @@ int testBrCr();
 int testBrCl();
 int testCrCl();
 int testAlBl();
+
+// The cross pairs (PAIR_AR_BR up to PAIR_CL_PISTE), measured together so the waiting loop has one frame of all pairs
+constexpr int NUM_CROSS_PAIRS = NUM_PAIRS - PAIR_AR_BR;
+extern int crossMeasurements[NUM_CROSS_PAIRS];
+void testCrossPairs();
+int pairMeasurement(Pair_t pair);  // Latest value of any pair, from measurements or crossMeasurements
+
+// Cheap check for the idle loop: three drive patterns, 4 samples on the nodes that move when anything gets
+// connected. Returns true when a node moved since the reference, or the reference is older than maxAgeMs; the
+// readings then become the new reference. The caller is expected to do its full scan when it returns true.
+bool presenceChanged(int maxAgeMs);
+void resetPresenceProbe();  // Next presenceChanged returns true
 bool IsBroken(int Nr, int threashold = 160);
 bool IsSwappedWith(int i, int j, int threashold = 160);
 void init_AD();
+
+// Table based conversions for the ADC_ATTEN_DB_11 characteristics, built by init_AD
+int adcRawToMilliVolts(int raw);
+int adcMilliVoltsToRaw(int milliVolts);  // Largest raw code that converts to less than milliVolts
+bool adcLookupTablesReady();
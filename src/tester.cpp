@@ -1,5 +1,6 @@
 #include "tester.h"
 
+#include "AdcStream.h"
 #include "globals.h"  // For DoCalibration and other globals
 
 // Global instance
@@ -24,14 +25,39 @@ Tester::~Tester() {
 }
 
 void Tester::UpdateThresholdsWithLeadResistance(float RLead) {
+    EmpiricalResistorCalibrator& calibrator = activeCalibrator();
+    thresholdLeadResistance = RLead;
     for (int i = 0; i < 11; i++) {
-        myRefs_Ohm[i] = mycalibrator.get_adc_threshold_for_resistance_with_leads(1.0 * i, RLead);
+        myRefs_Ohm[i] = calibrator.get_adc_threshold_for_resistance_with_leads(1.0 * i, RLead);
         // printf("Threshold[%d] = %d\n", i, myRefs_Ohm[i]);
     }
-    Ohm_20 = mycalibrator.get_adc_threshold_for_resistance_with_leads(20.0, RLead);
-    Ohm_25 = mycalibrator.get_adc_threshold_for_resistance_with_leads(25.0, RLead);
-    Ohm_30 = mycalibrator.get_adc_threshold_for_resistance_with_leads(30.0, RLead);
-    Ohm_50 = mycalibrator.get_adc_threshold_for_resistance_with_leads(50.0, RLead);
+    Ohm_20 = calibrator.get_adc_threshold_for_resistance_with_leads(20.0, RLead);
+    Ohm_25 = calibrator.get_adc_threshold_for_resistance_with_leads(25.0, RLead);
+    Ohm_30 = calibrator.get_adc_threshold_for_resistance_with_leads(30.0, RLead);
+    Ohm_50 = calibrator.get_adc_threshold_for_resistance_with_leads(50.0, RLead);
+
+    // Every value the test modes compare a differential sample against, so adaptive sampling
+    // only stops early when no decision can flip
+    int thresholds[11 + 4 + NUM_FIXED_THRESHOLDS];
+    int count = 0;
+    for (int i = 0; i < 11; i++) {
+        thresholds[count++] = myRefs_Ohm[i];
+    }
+    for (int scaled : {Ohm_20, Ohm_25, Ohm_30, Ohm_50}) {
+        thresholds[count++] = scaled;
+    }
+    for (int fixed : FIXED_THRESHOLDS_MV) {
+        thresholds[count++] = fixed;
+    }
+    setActiveThresholds(thresholds, count);
+
+    for (int i = 0; i < 11; i++) {
+        modeThresholds.ohm[i] = myRefs_Ohm[i];
+    }
+    modeThresholds.ohm20 = Ohm_20;
+    modeThresholds.ohm25 = Ohm_25;
+    modeThresholds.ohm50 = Ohm_50;
+    stateMachine.setThresholds(modeThresholds);
 }
 
 void Tester::begin(bool ForceCalibration) {
@@ -60,6 +86,17 @@ void Tester::begin(bool ForceCalibration) {
     } else {
         DefaultBlinkColor = LedPanel->m_Green;
     }
+    // The reduced drive strength is only used once it has its own calibration, taken right after the strong one
+    reducedDriveCalibrator.begin(br_analog, bl_analog);
+    if (ForceCalibration && UseReducedDrive && !IgnoreCalibrationWarning) {
+        printf("Repeat the calibration with reduced drive strength\n");
+        setDriveStrength(DRIVE_REDUCED);
+        reducedDriveCalibrated = reducedDriveCalibrator.calibrate_interactively_empirical() &&
+                                 reducedDriveCalibrator.save_calibration_to_nvs(REDUCED_DRIVE_CALIBRATION_NVS);
+        setDriveStrength(DRIVE_STRONG);
+    } else {
+        reducedDriveCalibrated = reducedDriveCalibrator.load_calibration_from_nvs(REDUCED_DRIVE_CALIBRATION_NVS);
+    }
     LedPanel->SetBlinkColor(DefaultBlinkColor);
     AverageLeadResistance = rtc.retrieve("LeadR", 0.0f);
 
@@ -68,6 +105,10 @@ void Tester::begin(bool ForceCalibration) {
     }
     UpdateThresholdsWithLeadResistance(0.0);
     SetWiretestMode(false);  // Normal mode, not Reel testing
+    // Calibration above reads the ADC with adc1_get_raw, so the DMA stream can only start now
+    if (UseDmaAdc) {
+        adcStream().begin();
+    }
     LedPanel->RestartBlink();
 
     // Below code lets you make a difference in lowpower time between cold boot and deep sleep
@@ -104,6 +145,7 @@ void Tester::taskLoop() {
     esp_task_wdt_add(NULL);
 
     while (true) {
+        runRequestedJob();
         /*if (DoCalibration) {
             ledPanel->ClearAll();
             Calibrate();
@@ -124,6 +166,13 @@ void Tester::taskLoop() {
                 handleWireTestingState2();
                 break;
 
+            case EpeeTesting:
+            case FoilTesting:
+            case LameTesting:
+            case ReelTesting:
+                handleSpecialTestingState();
+                break;
+
             default:
                 // Should not reach here
                 currentState = Waiting;
@@ -135,9 +184,23 @@ void Tester::taskLoop() {
     }
 }
 
+DetectedMode_t Tester::classifyMode() {
+    TesterFrame frame;
+    for (int p = 0; p < NUM_PAIRS; p++) {
+        frame.pairs[p] = pairMeasurement((Pair_t)p);
+    }
+    frame.timeMs = millis();
+    return classifyFrame(frame, modeThresholds, ReferenceBroken);
+}
+
 void Tester::handleWaitingState() {
-    // Always update measurements first
-    testWiresOnByOne();
+    // With the presence probe the full scan and the special mode probes only run when something changed on the
+    // connectors, or when the last full pass is PRESENCE_FORCED_SCAN_MS old
+    bool changed = !UsePresenceProbe || presenceChanged(PRESENCE_FORCED_SCAN_MS);
+    if (changed) {
+        testWiresOnByOne();
+        testCrossPairs();
+    }
     if (ReelMode) {
         if (ShowingShape != SHAPE_R) {
             LedPanel->ClearAll();
@@ -146,7 +209,7 @@ void Tester::handleWaitingState() {
             ShowingShape = SHAPE_R;
         }
         esp_task_wdt_reset();
-        if (testAlBl() < Ohm_50) {
+        if (changed && pairMeasurement(PAIR_CL_PISTE) < Ohm_50) {
             currentState = Waiting;
             ShowingShape = SHAPE_NONE;
             LedPanel->ClearAll();
@@ -171,36 +234,10 @@ void Tester::handleWaitingState() {
             }
         }
 #endif
-        // Check for special test modes
-
-        if (testArCr() < Ohm_20) {
-            currentState = EpeeTesting;
-            UpdateThresholdsWithLeadResistance(AverageLeadResistance * 2);
-            doEpeeTest();
-            doCommonReturnFromSpecialMode();
-            lastSpecialTestExit = millis();
-        } else if (testArBr() < Ohm_20) {
-            ledPanel->ClearAll();
-            UpdateThresholdsWithLeadResistance(AverageLeadResistance * 2);
-            doFoilTest();
-
-            doCommonReturnFromSpecialMode();
-            lastSpecialTestExit = millis();
-        } else if (testBrCr() < Ohm_20) {
-            UpdateThresholdsWithLeadResistance(AverageLeadResistance * 2);
-            doLameTest();
-
-            doCommonReturnFromSpecialMode();
-            lastSpecialTestExit = millis();
-        } else if ((testCrCl() < Ohm_20) && (measurements[1][1] > 160) && (measurements[2][2] > 160)) {
-            UpdateThresholdsWithLeadResistance(AverageLeadResistance);
-            doLameTest_Top();
-
-            doCommonReturnFromSpecialMode();
-            lastSpecialTestExit = millis();
-        } else if (testAlBl() < Ohm_50) {
-            UpdateThresholdsWithLeadResistance(AverageLeadResistance * 2);
-            doReelTest();
+        // Check for special test modes, a body cord is picked up by the wire test check below
+        DetectedMode_t detected = changed ? classifyMode() : MODE_NONE;
+        if (enterSpecialMode(detected)) {
+            return;
         }
 
         esp_task_wdt_reset();
@@ -212,6 +249,14 @@ void Tester::handleWaitingState() {
             UpdateThresholdsWithLeadResistance(0.0);
 
             currentState = WireTesting_1;
+            cordStartMs = millis();
+            cordActive = true;
+            cordLastSeenMs = cordStartMs;
+            cordFaults = 0;
+            for (float& lead : cordLeadOhm) {
+                lead = -1.0f;
+            }
+            express.start(cordStartMs);
             noWireTimeout = NO_WIRES_PLUGGED_IN_TIMEOUT;
             timeToSwitch = WIRE_TEST_1_TIMEOUT;
             ShowingShape = SHAPE_NONE;
@@ -222,9 +267,49 @@ void Tester::handleWaitingState() {
     }
 }
 
+void Tester::updateLeadResistances() {
+    if (testStraightOnly(myRefs_Ohm[1])) {
+        AverageLeadResistance = 0.0;
+        for (int i = 0; i < 3; i++) {
+            leadresistances[i] = activeCalibrator().get_resistance_empirical(measurements[i][i] / 1000.0);
+            AverageLeadResistance += leadresistances[i];
+            printf("Resistance lead[%d] = %.2f Ohm\n", i, leadresistances[i]);
+            fflush(stdout);                 // Force flush
+            vTaskDelay(pdMS_TO_TICKS(10));  // Small delay
+        }
+        if (AverageLeadResistance > 0.0) {
+            AverageLeadResistance /= 3.0;
+        } else {
+            AverageLeadResistance = 0.0;
+        }
+        printf("Average lead resistance = %f & setting blue\n", AverageLeadResistance);
+        LedPanel->SetBlinkColor(LedPanel->m_Blue);
+    }
+}
+
+// Every straight wire that is connected without a short gets its lead resistance recorded for the batch session.
+// Unlike the threshold update there is no 1 Ohm limit, yellow and orange wires count as well.
+void Tester::measureCordLeads() {
+    for (int i = 0; i < 3; i++) {
+        cordLeadOhm[i] = cordWireLevel(measurements, cordReferences(), i) >= 0
+                             ? activeCalibrator().get_resistance_empirical(measurements[i][i] / 1000.0)
+                             : -1.0f;
+    }
+}
+
 void Tester::handleWireTestingState1() {
+    if (ExpressCheck && !ReelMode) {
+        doExpressCheck();
+        return;
+    }
     testWiresOnByOne();
     allGood = doQuickCheck();
+    // The last check with the cord plugged in counts: on the scan that finds it unplugged every wire reads broken
+    if (WirePluggedIn(ReferenceBroken)) {
+        cordFaults = cordWireFaults(measurements, cordReferences());
+        measureCordLeads();
+        cordLastSeenMs = millis();
+    }
 
     if (allGood) {
         timeToSwitch--;
@@ -236,6 +321,7 @@ void Tester::handleWireTestingState1() {
             noWireTimeout = NO_WIRES_PLUGGED_IN_TIMEOUT;
         }
         if (!noWireTimeout) {
+            finishCord();
             currentState = Waiting;
             ShowingShape = SHAPE_NONE;
             // SetWiretestMode(false);
@@ -252,24 +338,7 @@ void Tester::handleWireTestingState1() {
         doQuickCheck(false);  // check one more time (just to keep the correct colors)
 
         // This is the time to update the threasholds with the lead resistance
-
-        if (testStraightOnly(myRefs_Ohm[1])) {
-            AverageLeadResistance = 0.0;
-            for (int i = 0; i < 3; i++) {
-                leadresistances[i] = mycalibrator.get_resistance_empirical(measurements[i][i] / 1000.0);
-                AverageLeadResistance += leadresistances[i];
-                printf("Resistance lead[%d] = %.2f Ohm\n", i, leadresistances[i]);
-                fflush(stdout);                 // Force flush
-                vTaskDelay(pdMS_TO_TICKS(10));  // Small delay
-            }
-            if (AverageLeadResistance > 0.0) {
-                AverageLeadResistance /= 3.0;
-            } else {
-                AverageLeadResistance = 0.0;
-            }
-            printf("Average lead resistance = %f & setting blue\n", AverageLeadResistance);
-            LedPanel->SetBlinkColor(LedPanel->m_Blue);
-        }
+        updateLeadResistances();
         ledPanel->myShow();
         esp_task_wdt_reset();
         vTaskDelay(1000 / portTICK_PERIOD_MS);
@@ -283,16 +352,22 @@ void Tester::handleWireTestingState1() {
 void Tester::handleWireTestingState2() {
     testWiresOnByOne();
     while (WirePluggedIn(ReferenceBroken)) {
-        for (int i = 100000; i > 0; i--) {
-            esp_task_wdt_reset();
-            if (!testStraightOnly(ReferenceBroken)) {
-                i = 0;
+        if (WiggleMinBreakUs > 0) {
+            waitForWiggleBreak();
+        } else {
+            for (int i = 100000; i > 0; i--) {
+                esp_task_wdt_reset();
+                if (!testStraightOnly(ReferenceBroken)) {
+                    i = 0;
+                }
             }
         }
+        cordLastSeenMs = millis();  // The break, or the cord being pulled out, was just seen
 
         ledPanel->ClearAll();
         ledPanel->myShow();
 
+        uint16_t breakFaults = cordWireFaults(measurements, cordReferences());
         for (int i = 0; i < 3; i++) {
             allGood &= animateSingleWire(i);
         }
@@ -304,7 +379,11 @@ void Tester::handleWireTestingState2() {
         ledPanel->myShow();
         doQuickCheck(false);  // check one more time (just to keep the correct colors)
         testWiresOnByOne();
+        if (WirePluggedIn(ReferenceBroken)) {
+            cordFaults |= breakFaults;  // Still plugged in, so it was a break and not the cord being pulled
+        }
     }
+    finishCord();
     timeToSwitch = WIRE_TEST_1_TIMEOUT;
     ledPanel->ClearAll();
     ledPanel->myShow();
@@ -313,444 +392,365 @@ void Tester::handleWireTestingState2() {
     SetWiretestMode(false);
 }
 
-void Tester::doCommonReturnFromSpecialMode() {
-    currentState = Waiting;
-    SetWiretestMode(false);
-    esp_task_wdt_reset();
-    ledPanel->ClearAll();
-    ledPanel->RestartBlink();
-
-    for (int i = 0; i < 25; i++) {
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        ledPanel->Blink();
-        esp_task_wdt_reset();
+// One scan of the express check per pass of taskLoop, the task sleeps between scans as in every other state.
+// Phase 2 of the wire test does not run: after the verdict a wire is only checked once per scan, so breaks shorter
+// than about two scans go unnoticed.
+void Tester::doExpressCheck() {
+    testWiresOnByOne();
+    unsigned long now = millis();
+    bool pluggedIn = WirePluggedIn(ReferenceBroken);
+    if (pluggedIn) {
+        cordLastSeenMs = now;
     }
+    switch (express.tick(measurements, cordReferences(), pluggedIn, now)) {
+        case EXPRESS_VERDICT:
+            showExpressFrame();
+            cordFaults = express.faults();
+            measureCordLeads();
+            allGood = express.passed();
+            if (!expressStats.cords) {
+                expressStats.firstStartMs = cordStartMs;
+            }
+            expressStats.cords++;
+            expressStats.passed += allGood;
+            expressStats.lastCordMs = now - cordStartMs;
+            expressStats.totalCordMs += expressStats.lastCordMs;
+            expressStats.lastVerdictMs = now;
+            if (allGood) {
+                updateLeadResistances();
+            }
+            break;
+
+        case EXPRESS_WIRE_DROPPED:
+            showExpressFrame();
+            cordFaults = express.faults();
+            if (allGood) {
+                allGood = false;
+                expressStats.passed--;
+            }
+            break;
 
-    ledPanel->ClearAll();
-    testWiresOnByOne();
-}
+        case EXPRESS_UNPLUGGED:
+            finishCord();
+            LedPanel->ClearAll();
+            LedPanel->myShow();
+            ShowingShape = SHAPE_NONE;
+            currentState = Waiting;
+            break;
 
-bool Tester::delayAndTestWirePluggedIn(long delay) {
-    long returnTime = millis() + delay;
-    while (millis() < returnTime) {
-        esp_task_wdt_reset();
-        testWiresOnByOne();
-        if (WirePluggedIn()) {
-            return true;
-        }
+        default:
+            break;
     }
-    return false;
 }
 
-bool Tester::delayAndTestWirePluggedInFoil(long delay) {
-    long returnTime = millis() + delay;
-    while (millis() < returnTime) {
-        esp_task_wdt_reset();
-        testWiresOnByOne();
-        if (WirePluggedInFoil()) {
-            return true;
-        }
+// The express verdict frame: each wire's line in its color, red when it has no level
+void Tester::showExpressFrame() {
+    const uint32_t colors[] = {LedPanel->m_Green, LedPanel->m_Yellow, LedPanel->m_Orange};
+    LedPanel->ClearAll();
+    for (int i = 0; i < 3; i++) {
+        int level = express.level(i);
+        LedPanel->SetLine(2 * i, level >= 0 ? colors[level] : LedPanel->m_Red);
     }
-    return false;
+    LedPanel->myShow();
 }
 
-bool Tester::delayAndTestWirePluggedInEpee(long delay) {
-    long returnTime = millis() + delay;
-    while (millis() < returnTime) {
-        esp_task_wdt_reset();
-        testWiresOnByOne();
-        if (WirePluggedInEpee()) {
-            return true;
-        }
+// Starts a special mode on the state machine: thresholds, drive strength, scan schedule and a clear display. Returns
+// false for the modes the state machine does not run, the caller goes on with the wire test check.
+bool Tester::enterSpecialMode(DetectedMode_t mode) {
+    ScanSchedule schedule;
+    switch (mode) {
+        case MODE_EPEE:
+            currentState = EpeeTesting;
+            schedule = SCAN_EPEE;
+            break;
+        case MODE_FOIL:
+            currentState = FoilTesting;
+            schedule = SCAN_FOIL;
+            break;
+        case MODE_LAME:
+            currentState = LameTesting;
+            schedule = SCAN_LAME;
+            break;
+        case MODE_LAME_TOP:
+            currentState = LameTesting;
+            schedule = SCAN_LAME_TOP;
+            break;
+        case MODE_REEL:
+            currentState = ReelTesting;
+            schedule = SCAN_EPEE;
+            break;
+        default:
+            return false;
     }
-    return false;
-}
-
-bool Tester::delayAndTestWirePluggedInLameTestTop(long delay) {
-    long returnTime = millis() + delay;
-    while (millis() < returnTime) {
-        esp_task_wdt_reset();
-        testWiresOnByOne();
-        if (WirePluggedInLameTopTesting()) {
-            return true;
-        }
+    UpdateThresholdsWithLeadResistance(mode == MODE_LAME_TOP ? AverageLeadResistance : AverageLeadResistance * 2);
+    if (mode == MODE_LAME || mode == MODE_LAME_TOP) {
+        selectDriveStrength(DRIVE_REDUCED);
     }
-    return false;
-}
-
-void Tester::doReelTest() {
-    ShowingShape = SHAPE_R;
-    LedPanel->ClearAll();
-    LedPanel->Draw_R(LedPanel->m_Green);
-    LedPanel->myShow();
-    SetWiretestMode(true);
-    while (!WirePluggedInEpee(ReferenceBroken)) {
-        esp_task_wdt_reset();
-        testWiresOnByOne();
+    if (mode == MODE_REEL) {
+        SetWiretestMode(true);
     }
+    testWiresOnByOne();
+    setScanSchedule(schedule);
+    resetPairTrackers();
     ShowingShape = SHAPE_NONE;
     LedPanel->ClearAll();
     LedPanel->myShow();
+    stateMachine.enter(mode, millis());
+    return true;
 }
 
-void Tester::doEpeeTest() {
-    int BrCl;
-    uint32_t tempColor;
-    testWiresOnByOne();
-    ShowingShape = SHAPE_NONE;
-    LedPanel->ClearAll();
-    while (!WirePluggedInEpee()) {
-        esp_task_wdt_reset();
-        BrCl = testBrCl();
-        if (BrCl < 500) {
-            // We're in Probe mode
-            if (SHAPE_P != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_P;
-            }
-            if (BrCl < myRefs_Ohm[5]) {
-                LedPanel->Draw_P(LedPanel->m_Green);
-            } else {
-                if (BrCl < myRefs_Ohm[8]) {
-                    LedPanel->Draw_P(LedPanel->m_Yellow);
-                } else {
-                    LedPanel->Draw_P(LedPanel->m_Red);
-                }
-            }
-            LedPanel->myShow();
-            if (delayAndTestWirePluggedInFoil(100)) {
-                break;
-            }
-            continue;
+// One tick of the special mode: a scan on the mode's schedule plus the pairs it classifies, then the display
+// commands. The task loop's vTaskDelay between ticks is the only wait, holds are deadlines in the state machine.
+void Tester::handleSpecialTestingState() {
+    scanScheduled();
+    TesterFrame frame;
+    uint16_t reads = stateMachine.pairsToRead();
+    for (int p = 0; p < NUM_PAIRS; p++) {
+        Pair_t pair = (Pair_t)p;
+        if (!(reads & (1 << p))) {
+            frame.pairs[p] = pairMeasurement(pair);
+        } else {
+            frame.pairs[p] = isPairTracking() ? trackPair(pair) : testPairCached(pair);
         }
+    }
+    frame.timeMs = millis();
 
-        int arCr = testArCr();
-        int arCl = testArCl();
-        int arBr = testArBr();
-        int brCr = testBrCr();
-
-        // Case 1: Both ArBr and BrCr > 1500, ArCl > 600
-        // No shorts -> Show E, ArCl > 600 means, no contact between tip and probe so measuring return wire
-        if ((arBr > 1500 && brCr > 1500) && arCl > 600) {
-            // Show color based on ArCr
-            if (arCr < myRefs_Ohm[2]) {
-                tempColor = LedPanel->m_Green;
-                // LedPanel->SetInner9(LedPanel->m_Green);
-            } else if (arCr < myRefs_Ohm[4]) {
-                // LedPanel->SetInner9(LedPanel->m_Yellow);
-                tempColor = LedPanel->m_Yellow;
-            } else if (arCr < 600) {
-                // LedPanel->SetInner9(LedPanel->m_Orange);
-                tempColor = LedPanel->m_Orange;
-            } else {
-                // Above 600, don't show anything
-                if (SHAPE_E != ShowingShape) {
-                    LedPanel->ClearAll();
-                    ShowingShape = SHAPE_E;
-                    LedPanel->Draw_E(LedPanel->m_White);
-                }
-                testWiresOnByOne();
-                continue;
-            }
-            if (SHAPE_SQUARE != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_SQUARE;
-            }
-            LedPanel->SetInner9(tempColor);
-            LedPanel->myShow();
-            if (delayAndTestWirePluggedInEpee(1000)) {
-                break;
-            }
-            // LedPanel->ClearAll();
-            LedPanel->myShow();
-        }
-        // Case 2: Both ArBr and BrCr > 1500, ArCl < 600
-        // No shorts -> Show E, ArCl < 600 means, contact between tip and probe so measuring single wire
-        else if ((arBr > 1500 && brCr > 1500) && arCl < 600) {
-            // Use thresholds divided by 2
-            if (arCl < myRefs_Ohm[1]) {
-                tempColor = LedPanel->m_Green;
-            } else if (arCl < myRefs_Ohm[2]) {
-                tempColor = LedPanel->m_Yellow;
-            } else if (arCl < myRefs_Ohm[10]) {
-                tempColor = LedPanel->m_Orange;
-            } else {
-                if (SHAPE_E != ShowingShape) {
-                    LedPanel->ClearAll();
-                    ShowingShape = SHAPE_E;
-                    LedPanel->Draw_E(LedPanel->m_White);
-                }
-                testWiresOnByOne();
-                continue;
-            }
-            if (SHAPE_SQUARE != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_SQUARE;
-            }
-            LedPanel->SetInner9(tempColor);
-            LedPanel->myShow();
-            if (delayAndTestWirePluggedInEpee(1000)) {
-                break;
-            }
-            // LedPanel->ClearAll();
-            LedPanel->myShow();
-        }
-        // Case 3: ArBr < 1500 or BrCr < 1500 (unwanted short)
-        else if (arBr < 1500 || brCr < 1500) {
-            LedPanel->ClearAll();
-            if (arBr < 1500) {
-                LedPanel->AnimateArBrConnection();
-            }
-            if (brCr < 1500) {
-                LedPanel->AnimateBrCrConnection();
-            }
-        }
-        // All other cases: draw white E
-        else {
-            if (SHAPE_E != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_E;
-                LedPanel->Draw_E(LedPanel->m_White);
-            }
-        }
+    DisplayCommand commands[MAX_DISPLAY_COMMANDS];
+    int count = stateMachine.tick(frame, commands);
+    for (int i = 0; i < count; i++) {
+        executeDisplayCommand(commands[i]);
+    }
+    if (count) {
+        LedPanel->myShow();
+    }
+    if (stateMachine.isActive()) {
+        return;
+    }
 
-        esp_task_wdt_reset();
-        testWiresOnByOne();
+    setScanSchedule(SCAN_FULL);
+    if (currentState == ReelTesting) {
+        // Back to waiting with ReelMode still on, the waiting state shows the R from now on. The probe's baseline
+        // is from before the reel test, a new one has to be taken like on every other exit.
+        ShowingShape = SHAPE_NONE;
+        currentState = Waiting;
+        resetPresenceProbe();
+        return;
     }
-    LedPanel->ClearAll();
-    LedPanel->myShow();
+    selectDriveStrength(DRIVE_STRONG);
+    doCommonReturnFromSpecialMode();
+    lastSpecialTestExit = millis();
 }
 
-void Tester::doFoilTest() {
-    testWiresOnByOne();
-    int BrCl;
-
-    while (!WirePluggedInFoil()) {
-        esp_task_wdt_reset();
-        LedPanel->myShow();
-        BrCl = testBrCl();
-        if (BrCl < 500) {
-            if (SHAPE_P != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_P;
-            }
-            if (BrCl < myRefs_Ohm[5]) {
-                LedPanel->Draw_P(LedPanel->m_Green);
-            } else {
-                if (BrCl < myRefs_Ohm[8]) {
-                    LedPanel->Draw_P(LedPanel->m_Yellow);
-                } else {
-                    LedPanel->Draw_P(LedPanel->m_Orange);
-                }
-            }
-            LedPanel->myShow();
-            if (delayAndTestWirePluggedInFoil(100)) {
-                Serial.println("Wire plugged in during foil light, breaking out");
-                break;
-            }
-            continue;
-        }
-
-        int arBr = testArBr();
-        if (SHAPE_F != ShowingShape) {
+void Tester::executeDisplayCommand(const DisplayCommand& command) {
+    const uint32_t colors[] = {LedPanel->m_Green, LedPanel->m_Yellow, LedPanel->m_Orange, LedPanel->m_Red,
+                               LedPanel->m_White};
+    uint32_t color = colors[command.color];
+    switch (command.op) {
+        case DISPLAY_CLEAR:
             LedPanel->ClearAll();
-            ShowingShape = SHAPE_F;
-        }
-        if (arBr < myRefs_Ohm[2]) {
-            LedPanel->Draw_F(LedPanel->m_Green);
-            testWiresOnByOne();
-            continue;
-        } else if (arBr < myRefs_Ohm[4]) {
-            LedPanel->Draw_F(LedPanel->m_Yellow);
-            testWiresOnByOne();
-            continue;
-        } else if (arBr < 2000) {
-            LedPanel->Draw_F(LedPanel->m_Orange);
-            testWiresOnByOne();
-            continue;
-        } else {
-            // Debounce: testArBr() > 1500 must be true for 10ms
-            bool debounced = true;
-            unsigned long start = millis();
-            while (millis() - start < 10) {
-                esp_task_wdt_reset();
-                if (testArBr() <= 1500) {
-                    debounced = false;
+            break;
+        case DISPLAY_INNER9:
+            LedPanel->SetInner9(color);
+            break;
+        case DISPLAY_ANIMATE_AR_BR:
+            LedPanel->AnimateArBrConnection();
+            break;
+        case DISPLAY_ANIMATE_BR_CR:
+            LedPanel->AnimateBrCrConnection();
+            break;
+        case DISPLAY_SHAPE:
+            switch (command.shape) {
+                case SHAPE_E:
+                    LedPanel->Draw_E(color);
+                    break;
+                case SHAPE_F:
+                    LedPanel->Draw_F(color);
+                    break;
+                case SHAPE_P:
+                    LedPanel->Draw_P(color);
+                    break;
+                case SHAPE_R:
+                    LedPanel->Draw_R(color);
+                    break;
+                case SHAPE_DIAMOND:
+                    LedPanel->DrawDiamond(color);
+                    break;
+                default:
                     break;
-                }
-                taskYIELD();
-            }
-
-            if (!debounced) {
-                Serial.println("Debouncing failed, continuing loop");
-                continue;
-            }
-
-            // Debouncing succeeded: show inner lights based on ArCl
-            if (SHAPE_SQUARE != ShowingShape) {
-                LedPanel->ClearAll();
-                ShowingShape = SHAPE_SQUARE;
-            }
-            if (testArCl() < myRefs_Ohm[1]) {
-                LedPanel->SetInner9(LedPanel->m_Green);
-            } else if (testArCl() < myRefs_Ohm[2]) {
-                LedPanel->SetInner9(LedPanel->m_Yellow);
-            } else if (testArCl() < 500) {
-                LedPanel->SetInner9(LedPanel->m_Orange);
-            } else {
-                LedPanel->SetInner9(LedPanel->m_White);
             }
-            LedPanel->myShow();
+            break;
+    }
+}
 
-            if (delayAndTestWirePluggedInFoil(1000)) {
-                Serial.println("Wire plugged in during foil light, breaking out");
-                break;
-            }
-            if (testArBr() <= 1500) {
-                LedPanel->ClearAll();
-                LedPanel->myShow();
-            }
+// The wiggle test in WIGGLE_SLICE_US slices with a tick for the other tasks in between, so IDLE gets to run
+bool Tester::runWiggleSlices(WiggleReport& report, uint32_t durationUs, bool stopOnDropout) {
+    beginWiggleTest(report, ReferenceBroken);
+    while (report.durationUs < durationUs) {
+        esp_task_wdt_reset();
+        uint32_t left = durationUs - report.durationUs;
+        if (continueWiggleTest(report, left < WIGGLE_SLICE_US ? left : WIGGLE_SLICE_US, WiggleMinBreakUs,
+                               stopOnDropout) &&
+            stopOnDropout) {
+            break;
         }
-
-        testWiresOnByOne();
+        vTaskDelay(1);
     }
-
-    Serial.println("Wire plugged in during foil test, leaving");
-    LedPanel->ClearAll();
-    LedPanel->myShow();
+    return endWiggleTest(report, WiggleMinBreakUs);
 }
 
-void Tester::doLameTest() {
-    // Your existing DoLameTest code
-    bool bShowingRed = false;
-    testWiresOnByOne();
-    while (!WirePluggedIn()) {
-        esp_task_wdt_reset();
-        if (testBrCr() < myRefs_Ohm[5]) {
-            LedPanel->DrawDiamond(LedPanel->m_Green);
-            bShowingRed = false;
-            // while((testBrCr()<myRefs_Ohm[5])){esp_task_wdt_reset();};
-            while (debouncedCondition(
-                [this]() {
-                    int temp = testBrCr();
-                    return temp < myRefs_Ohm[5];
-                },
-                10));
-        } else {
-            if (testBrCr() < myRefs_Ohm[10]) {
-                LedPanel->DrawDiamond(LedPanel->m_Yellow);
-                bShowingRed = false;
-                // while((testBrCr()<myRefs_Ohm[10])){esp_task_wdt_reset();};
-                while (debouncedCondition(
-                    [this]() {
-                        int temp = testBrCr();
-                        return ((temp < myRefs_Ohm[10]) && (temp >= myRefs_Ohm[5]));
-                    },
-                    10));
-            } else {
-                if (testBrCr() < Ohm_25) {
-                    LedPanel->DrawDiamond(LedPanel->m_Orange);
-                    bShowingRed = false;
-                    // while((testBrCr()<myRefs_Ohm[10])){esp_task_wdt_reset();};
-                    while (debouncedCondition(
-                        [this]() {
-                            int temp = testBrCr();
-                            return ((temp < myRefs_Ohm[25]) && (temp >= myRefs_Ohm[10]));
-                        },
-                        10));
-                } else {
-                    // Do Red stuff
-                    bShowingRed = true;
-                    LedPanel->DrawDiamond(LedPanel->m_Red);
-                    if (delayAndTestWirePluggedIn(250))
-                        break;
-                }
-            }
+// Runs the wiggle detector until a straight wire drops out for WiggleMinBreakUs. The worst reading of a wire
+// that dropped out goes into measurements, so animateSingleWire shows it even when it closed again.
+void Tester::waitForWiggleBreak() {
+    WiggleReport report;
+    runWiggleSlices(report, WIGGLE_MAX_SLICES * WIGGLE_SLICE_US, true);
+    for (int Nr = 0; Nr < 3; Nr++) {
+        const WiggleWireStats& wire = report.wires[Nr];
+        measurements[Nr][Nr] = wire.dropouts ? wire.maxMv : wire.lastMv;
+        if (wire.dropouts) {
+            printf("Wire %d dropped out for %lu us (%d to %d mV)\n", Nr, (unsigned long)wire.longestBreakUs,
+                   wire.minMv, wire.maxMv);
         }
+    }
+}
 
-        esp_task_wdt_reset();
-        testWiresOnByOne();
+// Between two passes of taskLoop no measurement is half done
+void Tester::runRequestedJob() {
+    int expected = REQUEST_PENDING;
+    if (!requestState.compare_exchange_strong(expected, REQUEST_RUNNING)) {
+        return;
     }
-    LedPanel->ClearAll();
-    LedPanel->myShow();
+    ScanSchedule schedule = getScanSchedule();
+    requestJob(requestContext);
+    setScanSchedule(schedule);
+    invalidateMeasurementCache();
+    requestState = REQUEST_DONE;
 }
 
-bool DebounceTest(int LowBound, int HighBound) {
-    testWiresOnByOne();
-    if (WirePluggedInLameTopTesting()) {
+bool Tester::runInTesterTask(void (*job)(void* context), void* context, uint32_t startTimeoutMs) {
+    if (testerTaskHandle == nullptr) {
+        return false;
+    }
+    int expected = REQUEST_IDLE;
+    if (!requestState.compare_exchange_strong(expected, REQUEST_SETUP)) {
         return false;
     }
-    return ((testCrCl() >= LowBound) && (testCrCl() < HighBound));
+    requestJob = job;
+    requestContext = context;
+    requestState = REQUEST_PENDING;
+    uint32_t deadlineMs = millis() + startTimeoutMs;
+    while (requestState != REQUEST_DONE) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+        expected = REQUEST_PENDING;
+        // Not started in time: withdraw the request. Once running it always finishes.
+        if ((int32_t)(millis() - deadlineMs) > 0 && requestState.compare_exchange_strong(expected, REQUEST_IDLE)) {
+            return false;
+        }
+    }
+    requestState = REQUEST_IDLE;
+    return true;
 }
 
-void Tester::doLameTest_Top() {
-    // Your existing DoLameTest code
-    bool bShowingRed = false;
-    testWiresOnByOne();
-    while (!WirePluggedInLameTopTesting()) {
-        esp_task_wdt_reset();
-        if (testCrCl() < myRefs_Ohm[5]) {
-            LedPanel->DrawDiamond(LedPanel->m_Green);
-            bShowingRed = false;
+namespace {
 
-            while (debouncedCondition([this]() { return DebounceTest(0, myRefs_Ohm[5]); }, 10));
-        } else {
-            if (testCrCl() < myRefs_Ohm[10]) {
-                LedPanel->DrawDiamond(LedPanel->m_Yellow);
-                bShowingRed = false;
-                while (debouncedCondition([this]() { return DebounceTest(myRefs_Ohm[5], myRefs_Ohm[10]); }, 10));
-            } else {
-                if (testCrCl() < Ohm_25) {
-                    LedPanel->DrawDiamond(LedPanel->m_Orange);
-                    bShowingRed = false;
-                    // while((testBrCr()<myRefs_Ohm[10])){esp_task_wdt_reset();};
-                    while (debouncedCondition([this]() { return DebounceTest(myRefs_Ohm[10], Ohm_25); }, 10));
-                } else {
-                    LedPanel->DrawDiamond(LedPanel->m_Red);
-                    bShowingRed = true;
-                    if (delayAndTestWirePluggedInLameTestTop(250))
-                        break;
-                }
-            }
-        }
+struct WiggleRun {
+    Tester* tester;
+    WiggleReport* report;
+    uint32_t durationUs;
+};
+
+}  // namespace
+
+bool Tester::runWiggle(WiggleReport& report, uint32_t durationUs) {
+    WiggleRun run = {this, &report, durationUs};
+    auto job = [](void* context) {
+        WiggleRun* run = static_cast<WiggleRun*>(context);
+        run->tester->runWiggleSlices(*run->report, run->durationUs, false);
+    };
+    return runInTesterTask(job, &run, durationUs / 1000 + WIGGLE_START_TIMEOUT_MS);
+}
 
+void Tester::doCommonReturnFromSpecialMode() {
+    currentState = Waiting;
+    SetWiretestMode(false);
+    resetPresenceProbe();
+    esp_task_wdt_reset();
+    ledPanel->ClearAll();
+    ledPanel->RestartBlink();
+
+    for (int i = 0; i < 25; i++) {
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+        ledPanel->Blink();
         esp_task_wdt_reset();
-        testWiresOnByOne();
     }
-    LedPanel->ClearAll();
-    LedPanel->myShow();
+
+    ledPanel->ClearAll();
+    testWiresOnByOne();
 }
+
+// Switches the drivers and recomputes the thresholds with the matching calibration. The reduced strength
+// needs both the ReducedDrive setting and its own calibration, otherwise everything stays on the strong drive.
+void Tester::selectDriveStrength(DriveStrength_t strength) {
+    if (!UseReducedDrive || !reducedDriveCalibrated) {
+        strength = DRIVE_STRONG;
+    }
+    if (strength == getDriveStrength()) {
+        return;
+    }
+    setDriveStrength(strength);
+    UpdateThresholdsWithLeadResistance(thresholdLeadResistance);
+}
+
 void Tester::SetWiretestMode(bool Reelmode) {
+    // The reel test runs on the reduced drive, its thresholds have to be in place before the references below
+    selectDriveStrength(Reelmode ? DRIVE_REDUCED : DRIVE_STRONG);
     if (Reelmode) {
         ReferenceBroken = Ohm_50;
         ReferenceGreen = myRefs_Ohm[10];
         ReferenceYellow = Ohm_20;
         ReferenceOrange = Ohm_50;
-        ReferenceShort = 300;
+        ReferenceShort = REEL_SHORT_MV;
         ReelMode = true;
     } else {
         ReferenceBroken = myRefs_Ohm[10];
         ReferenceGreen = myRefs_Ohm[1];
         ReferenceYellow = myRefs_Ohm[3];
         ReferenceOrange = myRefs_Ohm[10];
-        ReferenceShort = 160;
+        ReferenceShort = CONNECTED_MV;
         ReelMode = false;
     }
 }
 
+// End of a body cord test: it goes into the batch session, which leaves out brief touches. Reels are not counted.
+void Tester::finishCord() {
+    if (!cordActive) {
+        return;
+    }
+    cordActive = false;
+    if (!batch.isActive() || ReelMode) {
+        return;
+    }
+    CordRecord record;
+    record.faults = cordFaults;
+    record.durationMs = cordLastSeenMs - cordStartMs;
+    for (int i = 0; i < 3; i++) {
+        float milliOhm = cordLeadOhm[i] * 1000.0f;
+        bool valid = milliOhm >= 0.0f && milliOhm < LEAD_NOT_MEASURED;
+        record.leadMilliOhm[i] = valid ? (uint16_t)milliOhm : LEAD_NOT_MEASURED;
+    }
+    uint16_t sequence = batch.addCord(record, millis());
+    if (!sequence) {
+        return;
+    }
+    printf("Cord %u: %s in %lu ms\n", sequence, cordFaults ? "failed" : "passed", (unsigned long)record.durationMs);
+}
+
 bool Tester::animateSingleWire(int wireIndex, bool ReelMode) {
     // Your existing AnimateSingleWire code
     bool bOK = false;
+    int level = cordWireLevel(measurements, cordReferences(), wireIndex);
     if (measurements[wireIndex][wireIndex] < ReferenceBroken) {
-        if ((measurements[wireIndex][(wireIndex + 1) % 3] > 200) &&
-            (measurements[wireIndex][(wireIndex + 2) % 3] > 200)) {
+        if (level >= 0) {
             // OK
-            int level = 2;
-            if (measurements[wireIndex][wireIndex] <= ReferenceYellow)
-                level = 1;
-            if (measurements[wireIndex][wireIndex] <= ReferenceGreen)
-                level = 0;
-
             LedPanel->AnimateGoodConnection(wireIndex, level);
             bOK = true;
         } else {
@@ -808,30 +808,3 @@ void Tester::stopCalibration() { DoCalibration = false; }
 
 // void Tester::setReferenceValues(int* refs) { myRefs_Ohm = refs; }
 // int* Tester::getReferenceValues() const { return myRefs_Ohm; }
-
-bool Tester::debouncedCondition(std::function<bool()> condition, int debounceMs) {
-    unsigned long falseStartTime = 0;
-    bool timing = false;
-
-    while (true) {
-        bool currentCondition = condition();
-
-        if (currentCondition) {
-            // Condition is true, reset timer and keep waiting
-            timing = false;
-            falseStartTime = 0;
-        } else {
-            if (!timing) {
-                // Just became false, start timing
-                falseStartTime = millis();
-                timing = true;
-            }
-            // Check if it's been false long enough
-            if (millis() - falseStartTime >= debounceMs) {
-                return false;  // Debounced: condition has been false for debounceMs
-            }
-        }
-        esp_task_wdt_reset();
-        taskYIELD();
-    }
-}
@@ -2,17 +2,22 @@
 
 #include <Arduino.h>
 
+#include <atomic>
+
+#include "BatchSession.h"
+#include "BodyCordCheck.h"
 #include "DeepSleepHandler.h"
 #include "RTCMemoryStorage.h"
+#include "TesterStateMachine.h"
 #include "WS2812BLedMatrix.h"
 #include "WiFiPowerManager.h"
+#include "WiggleTest.h"
 #include "adc_calibrator.h"
 #include "esp_task_wdt.h"
 #include "resitancemeasurement.h"
 
 // State enum
 typedef enum { Waiting, EpeeTesting, FoilTesting, LameTesting, WireTesting_1, WireTesting_2, ReelTesting } State_t;
-typedef enum { SHAPE_F, SHAPE_E, SHAPE_S, SHAPE_P, SHAPE_DIAMOND, SHAPE_SQUARE, SHAPE_R, SHAPE_NONE } Shapes_t;
 
 // Timeout constants
 constexpr int WIRE_TEST_1_TIMEOUT = 2;
@@ -20,6 +25,22 @@ constexpr int NO_WIRES_PLUGGED_IN_TIMEOUT = 2;
 constexpr int NO_WIRES_PLUGGED_IN_TIMEOUT_REEL = 7;
 constexpr int FOIL_TEST_TIMEOUT = 1000;
 constexpr int WIRE_TEST_DELAY = 2000;  // 2 seconds delay after special test exit
+constexpr const char* REDUCED_DRIVE_CALIBRATION_NVS = "emp_cal_r";
+constexpr uint32_t WIGGLE_SLICE_US = 100000;  // The wiggle test gives the core a tick between slices
+constexpr int WIGGLE_MAX_SLICES = 10000;       // About as long as the 100000 testStraightOnly iterations
+constexpr int WIGGLE_START_TIMEOUT_MS = 1000;  // runWiggle gives up when the tester task has not started it by then
+constexpr int JOB_START_TIMEOUT_MS = 2000;     // runInTesterTask default, about one pass of wire test phase 1
+constexpr int PRESENCE_FORCED_SCAN_MS = 500;  // Full waiting-state pass at least this often with the presence probe
+
+// Express check results since boot or the last reset, times in ms
+struct ExpressStats {
+    uint32_t cords;
+    uint32_t passed;
+    uint32_t firstStartMs;   // First cord plugged in
+    uint32_t lastVerdictMs;  // Last verdict shown
+    uint32_t lastCordMs;     // Plug-in to verdict of the last cord
+    uint32_t totalCordMs;
+};
 
 class Tester {
    private:
@@ -52,34 +73,65 @@ class Tester {
     int ReferenceGreen = myRefs_Ohm[1];
     int ReferenceYellow = myRefs_Ohm[3];
     int ReferenceOrange = myRefs_Ohm[10];
-    int ReferenceShort = 160;
+    int ReferenceShort = CONNECTED_MV;
     bool ReelMode = false;
     RTCMemoryStorage rtc;
     EmpiricalResistorCalibrator mycalibrator;
+    EmpiricalResistorCalibrator reducedDriveCalibrator;  // Same model, constants taken at DRIVE_REDUCED
+    bool reducedDriveCalibrated = false;
+    bool UseReducedDrive = false;
+    bool UsePresenceProbe = false;
+    uint32_t WiggleMinBreakUs = 0;  // 0 keeps the testStraightOnly loop in the second wire test phase
+    float thresholdLeadResistance = 0.0;  // Lead resistance the current thresholds include
     float leadresistances[3] = {0.0, 0.0, 0.0};
     float AverageLeadResistance = 0.0;
     bool IgnoreCalibrationWarning = false;
+    bool UseDmaAdc = false;
+    bool ExpressCheck = false;
+    ExpressStats expressStats = {};
+    ExpressCordCheck express;  // One tick per pass of taskLoop while ExpressCheck runs a body cord
+    unsigned long cordStartMs = 0;
+    bool cordActive = false;  // A body cord test is running, from plug-in until it goes back to waiting
+    uint16_t cordFaults = 0;  // wireFaults() found on that cord
+    unsigned long cordLastSeenMs = 0;  // Last scan that still saw the cord plugged in
+    float cordLeadOhm[3] = {-1.0f, -1.0f, -1.0f};  // Lead of each straight wire on that scan, -1 when not connected
+    BatchSession batch;
+    TesterStateMachine stateMachine;  // Epee, foil, lame, lame top and reel, one tick per pass of taskLoop
+    TesterThresholds modeThresholds;  // The thresholds above, as classifyFrame and stateMachine take them
+    // Job asked for by runInTesterTask, the tester task does it between two passes of taskLoop. The caller owns the
+    // job in REQUEST_SETUP, the tester task from REQUEST_PENDING up to REQUEST_DONE.
+    enum { REQUEST_IDLE, REQUEST_SETUP, REQUEST_PENDING, REQUEST_RUNNING, REQUEST_DONE };
+    std::atomic<int> requestState{REQUEST_IDLE};
+    void (*requestJob)(void* context) = nullptr;
+    void* requestContext = nullptr;
     // Private methods
 
     void doCommonReturnFromSpecialMode();
-    bool delayAndTestWirePluggedIn(long delay);
-    bool delayAndTestWirePluggedInFoil(long delay);
-    bool delayAndTestWirePluggedInEpee(long delay);
-    bool delayAndTestWirePluggedInLameTestTop(long delay);
-    void doEpeeTest();
-    void doFoilTest();
-    void doLameTest();
-    void doLameTest_Top();
-    void doReelTest();
+    CordReferences cordReferences() const { return {ReferenceBroken, ReferenceGreen, ReferenceYellow, ReferenceShort}; }
+    void finishCord();
     bool animateSingleWire(int wireIndex, bool ReelMode = false);
     void SetWiretestMode(bool Reelmode);
     bool GetWiretestMode() { return ReelMode; };
+    void selectDriveStrength(DriveStrength_t strength);
+    EmpiricalResistorCalibrator& activeCalibrator() {
+        return getDriveStrength() == DRIVE_REDUCED ? reducedDriveCalibrator : mycalibrator;
+    }
+    DetectedMode_t classifyMode();
 
     bool doQuickCheck(bool bClearAtTheEnd = true);
     void handleWaitingState();
     void handleWireTestingState1();
+    void updateLeadResistances();
+    void measureCordLeads();
+    void doExpressCheck();
+    void showExpressFrame();
     void handleWireTestingState2();
-    bool debouncedCondition(std::function<bool()> condition, int debounceMs = 10);
+    bool enterSpecialMode(DetectedMode_t mode);
+    void handleSpecialTestingState();
+    void executeDisplayCommand(const DisplayCommand& command);
+    void waitForWiggleBreak();
+    bool runWiggleSlices(WiggleReport& report, uint32_t durationUs, bool stopOnDropout);
+    void runRequestedJob();
 
     // Static task wrapper
     static void testerTaskWrapper(void* parameter);
@@ -95,6 +147,24 @@ class Tester {
     void begin(bool ForceCalibration = false);
     void stop();
     void setIgnoreCalibrationWarning(bool value) { IgnoreCalibrationWarning = value; };
+    void setUseDmaAdc(bool value) { UseDmaAdc = value; };
+    void setUseReducedDrive(bool value) { UseReducedDrive = value; };
+    void setUsePresenceProbe(bool value) { UsePresenceProbe = value; };
+    void setWiggleMinBreakUs(uint32_t value) { WiggleMinBreakUs = value; };
+    void setExpressCheck(bool value) { ExpressCheck = value; };
+    const ExpressStats& getExpressStats() const { return expressStats; };
+    void resetExpressStats() { expressStats = {}; };
+    BatchSession& getBatchSession() { return batch; };
+    void setDebounceHysteresisMv(int value) { stateMachine.setHysteresisMv(value); };
+    // Runs job(context) in the tester task between two passes of taskLoop and waits for it. There no measurement is
+    // half done, so the job may drive the pins, stop the DMA stream or change the scan schedule: the schedule is put
+    // back and the measurement cache dropped afterwards. Returns false when the tester task did not start it within
+    // startTimeoutMs, e.g. in the middle of a test.
+    bool runInTesterTask(void (*job)(void* context), void* context, uint32_t startTimeoutMs = JOB_START_TIMEOUT_MS);
+    // Runs the wiggle test for durationUs in the tester task, where it cannot cut a measurement short, and waits
+    // for the report. Returns false when the tester task did not get to it, e.g. in the middle of a test.
+    bool runWiggle(WiggleReport& report, uint32_t durationUs);
+    int getBrokenThreshold() const { return ReferenceBroken; };
     State_t getState() const;
     void setState(State_t newState);
     bool isAllGood() const;
@@ -105,6 +175,8 @@ class Tester {
     float get_v_gpio() const { return mycalibrator.get_v_gpio(); };
     float get_r1_r2() const { return mycalibrator.get_r1_r2(); };
     float get_correction() const { return mycalibrator.get_correction(); };
+    bool hasReducedDriveCalibration() const { return reducedDriveCalibrated; };
+    const EmpiricalResistorCalibrator& getReducedDriveCalibrator() const { return reducedDriveCalibrator; };
     void UpdateThresholdsWithLeadResistance(float RLead);
 
     // Main task loop
@@ -0,0 +1,227 @@
+/**
+ * Replay of scripted frames through the special mode state machine
+ *
+ * Every scenario is a list of frame segments: the pairs that differ from "nothing connected" (4000 mV on every
+ * pair) for a number of 10 ms ticks, the cadence of the tester task. The state machine runs on the host exactly as
+ * on the device, so the printed display commands are what the panel would show. Each scenario is replayed twice and
+ * must give the same commands both times, they must be the expected ones, and it must leave its mode on the first
+ * frame with a wire plugged in.
+ *
+ * Build and run on the host from the repository root:
+ *   g++ -O2 -std=gnu++11 -o tester_state_replay tester_state_replay.cpp src/TesterStateMachine.cpp
+ *   ./tester_state_replay
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "src/TesterStateMachine.h"
+
+const int OPEN_MV = 4000;
+const int TICK_MS = 10;
+
+// Thresholds of a typical calibration, 1 Ohm is about 25 mV
+const int OHM_MV = 25;
+
+struct Setting {
+    // A constructor rather than default member initializers: gnu++11 does not allow those in an aggregate
+    Setting(Pair_t pair = PAIR_AR_CR, int mv = OPEN_MV, int jitterMv = 0) : pair(pair), mv(mv), jitterMv(jitterMv) {}
+
+    Pair_t pair;
+    int mv;
+    int jitterMv;  // Alternately added and taken off from tick to tick
+};
+
+struct Segment {
+    int ticks;
+    int count;
+    Setting settings[4];
+};
+
+struct Scenario {
+    const char* name;
+    DetectedMode_t mode;
+    int hysteresisMv;  // DebounceHysteresis setting
+    int exitTick;      // Tick on which the mode has to end, -1 if it must stay active
+    const char* expected;
+    int segmentCount;
+    Segment segments[6];
+};
+
+const Scenario scenarios[] = {
+    {"epee, tip pressed, wire plugged in",
+     MODE_EPEE,
+     0,
+     230,
+     "     0 ms  clear  \n"
+     "     0 ms  inner9  yellow\n"
+     "  1000 ms  clear  \n"
+     "  1000 ms  shape E white\n"
+     "  2300 ms  clear  \n",
+     3,
+     {{50, 1, {{PAIR_AR_CR, 2 * OHM_MV}}}, {180, 1, {{PAIR_AR_CR, 3000}}}, {5, 1, {{PAIR_AR_PISTE, 50}}}}},
+    {"epee, probe on the guard",
+     MODE_EPEE,
+     0,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape P yellow\n"
+     "   300 ms  clear  \n"
+     "   300 ms  shape E white\n",
+     2,
+     {{30, 1, {{PAIR_BR_CL, 6 * OHM_MV}}}, {30, 0, {}}}},
+    {"foil, hit with a short blip first",
+     MODE_FOIL,
+     0,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape F green\n"
+     "   420 ms  clear  \n"
+     "   420 ms  inner9  orange\n",
+     4,
+     {{20, 1, {{PAIR_AR_BR, OHM_MV}}}, {1, 0, {}}, {20, 1, {{PAIR_AR_BR, OHM_MV}}}, {150, 1, {{PAIR_AR_CL, 400}}}}},
+    {"foil, blade at 1700 mV before and during a hit",
+     MODE_FOIL,
+     0,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape F orange\n"
+     "   110 ms  clear  \n"
+     "   110 ms  inner9  white\n",
+     3,
+     {{10, 1, {{PAIR_AR_BR, 1700}}}, {1, 0, {}}, {10, 1, {{PAIR_AR_BR, 1700}}}}},
+    {"lame, good, then lifted",
+     MODE_LAME,
+     0,
+     60,
+     "     0 ms  clear  \n"
+     "     0 ms  shape diamond green\n"
+     "   410 ms  shape diamond red\n"
+     "   600 ms  clear  \n",
+     3,
+     {{40, 1, {{PAIR_BR_CR, 3 * OHM_MV}}}, {20, 0, {}}, {5, 1, {{PAIR_CR_CL, 50}}}}},
+    {"lame, noise across the green/yellow edge and a one-tick spike",
+     MODE_LAME,
+     0,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape diamond green\n",
+     4,
+     {{10, 1, {{PAIR_BR_CR, 3 * OHM_MV}}},
+      {31, 1, {{PAIR_BR_CR, 5 * OHM_MV, 10}}},
+      {1, 1, {{PAIR_BR_CR, 3000}}},
+      {10, 1, {{PAIR_BR_CR, 3 * OHM_MV}}}}},
+    {"lame, settles just past the edge, hysteresis keeps green",
+     MODE_LAME,
+     20,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape diamond green\n"
+     "   310 ms  shape diamond yellow\n",
+     3,
+     {{10, 1, {{PAIR_BR_CR, 3 * OHM_MV}}},
+      {20, 1, {{PAIR_BR_CR, 5 * OHM_MV + 10}}},
+      {20, 1, {{PAIR_BR_CR, 7 * OHM_MV}}}}},
+    {"lame top, worn spot",
+     MODE_LAME_TOP,
+     0,
+     -1,
+     "     0 ms  clear  \n"
+     "     0 ms  shape diamond yellow\n"
+     "   210 ms  shape diamond red\n",
+     2,
+     {{20, 1, {{PAIR_CR_CL, 7 * OHM_MV}}}, {20, 1, {{PAIR_CR_CL, 40 * OHM_MV}}}}},
+    {"reel, reel wire plugged in",
+     MODE_REEL,
+     0,
+     10,
+     "     0 ms  clear  \n"
+     "     0 ms  shape R green\n"
+     "   100 ms  clear  \n",
+     2,
+     {{10, 0, {}}, {3, 1, {{PAIR_AR_PISTE, 30 * OHM_MV}}}}},
+};
+
+const char* opNames[] = {"clear", "shape", "inner9", "animate ArBr", "animate BrCr"};
+const char* shapeNames[] = {"F", "E", "S", "P", "diamond", "square", "R", "-"};
+const char* colorNames[] = {"green", "yellow", "orange", "red", "white"};
+
+// Runs one scenario, returns the command trace. exitTick gets the tick the mode ended on, -1 if it did not.
+std::string replay(const Scenario& scenario, bool print, int& exitTick) {
+    TesterStateMachine machine;
+    TesterThresholds thresholds;
+    for (int i = 0; i < 11; i++) {
+        thresholds.ohm[i] = i * OHM_MV;
+    }
+    thresholds.ohm20 = 20 * OHM_MV;
+    thresholds.ohm25 = 25 * OHM_MV;
+    thresholds.ohm50 = 50 * OHM_MV;
+    machine.setThresholds(thresholds);
+    machine.setHysteresisMv(scenario.hysteresisMv);
+
+    std::string trace;
+    exitTick = -1;
+    uint32_t now = 1000;
+    machine.enter(scenario.mode, now);
+    int tick = 0;
+    for (int s = 0; s < scenario.segmentCount && machine.isActive(); s++) {
+        const Segment& segment = scenario.segments[s];
+        for (int t = 0; t < segment.ticks && machine.isActive(); t++, tick++, now += TICK_MS) {
+            TesterFrame frame;
+            for (int p = 0; p < NUM_PAIRS; p++) {
+                frame.pairs[p] = OPEN_MV;
+            }
+            for (int i = 0; i < segment.count; i++) {
+                const Setting& setting = segment.settings[i];
+                frame.pairs[setting.pair] = setting.mv + (t % 2 ? setting.jitterMv : -setting.jitterMv);
+            }
+            frame.timeMs = now;
+
+            DisplayCommand commands[MAX_DISPLAY_COMMANDS];
+            int count = machine.tick(frame, commands);
+            for (int i = 0; i < count; i++) {
+                char line[80];
+                snprintf(line, sizeof(line), "  %4d ms  %s %s %s\n", tick * TICK_MS, opNames[commands[i].op],
+                         commands[i].op == DISPLAY_SHAPE ? shapeNames[commands[i].shape] : "",
+                         commands[i].op == DISPLAY_SHAPE || commands[i].op == DISPLAY_INNER9
+                             ? colorNames[commands[i].color]
+                             : "");
+                trace += line;
+            }
+            if (!machine.isActive()) {
+                exitTick = tick;
+            }
+        }
+    }
+    if (print) {
+        printf("%s\n%s", scenario.name, trace.c_str());
+    }
+    return trace;
+}
+
+int main() {
+    int failures = 0;
+    for (const Scenario& scenario : scenarios) {
+        int exitTick;
+        int repeatExitTick;
+        std::string first = replay(scenario, true, exitTick);
+        std::string second = replay(scenario, false, repeatExitTick);
+        if (first != second || exitTick != repeatExitTick) {
+            printf("  FAIL: replay gave different commands\n");
+            failures++;
+        }
+        if (first != scenario.expected) {
+            printf("  FAIL: expected\n%s", scenario.expected);
+            failures++;
+        }
+        if (exitTick != scenario.exitTick) {
+            printf("  FAIL: left the mode on tick %d, expected %d\n", exitTick, scenario.exitTick);
+            failures++;
+        }
+        printf("\n");
+    }
+    printf("%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
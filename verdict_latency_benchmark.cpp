@@ -0,0 +1,377 @@
+/**
+ * Plug-in-to-verdict latency of the tester
+ *
+ * Scripted events (plugging in a weapon, a lame or a body cord, pressing the foil tip) against a simulated wire
+ * network: every pair has a resistance before and after the event, the contacts bounce for a few ms, and every
+ * reading gets ADC noise. The tester task is replayed the way Tester runs it: a full scan plus the cross pairs and
+ * classifyFrame on every waiting pass, then TesterStateMachine ticks on the mode's scan schedule. A body cord with
+ * the ExpressCheck setting goes to ExpressCordCheck instead, one tick per full scan, up to its verdict. Time advances
+ * by PAIR_US per measured pair and TASK_DELAY_US per task loop pass. Each display command is an LED frame with a
+ * timestamp; the time to verdict runs from the event to the first frame that shows the scenario's verdict.
+ *
+ * The body cord path without ExpressCheck (doQuickCheck, wire test phase 1) has no host-buildable counterpart. Its
+ * number is modelled from the fixed delays in tester.cpp, up to the point where the blink turns blue, so it is only
+ * reported and has no budget.
+ *
+ * Exits with 1 when a p50 or p99 of the other scenarios exceeds its budget. A change that is meant to move a latency
+ * updates the budget.
+ *
+ * Build and run on the host from the repository root:
+ *   g++ -O2 -std=gnu++11 -o verdict_latency_benchmark verdict_latency_benchmark.cpp src/TesterStateMachine.cpp \
+ *       src/BodyCordCheck.cpp
+ *   ./verdict_latency_benchmark
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "src/BodyCordCheck.h"
+#include "src/TesterStateMachine.h"
+
+const double PAIR_US = 700.0;          // One pair: drive pattern, settle, NUM_ADC_SAMPLES differential samples
+const double TASK_DELAY_US = 10000.0;  // vTaskDelay at the end of every taskLoop pass
+const double BOUNCE_US = 3000.0;       // Contacts bounce between the old and the new state after an event
+const double TIMEOUT_US = 10e6;        // No verdict within this time counts as a failure
+const int OHM_MV = 25;                 // Calibration without leads, 1 Ohm is about 25 mV
+const int OPEN_MV = 4000;
+const float NOISE_MV = 4.0f;
+const int TRIALS = 2000;
+
+// Body cord model, from tester.cpp: WIRE_TEST_1_TIMEOUT good passes of testWiresOnByOne + doQuickCheck, then
+// doQuickCheck(false) and testStraightOnly before the blink turns blue. animateSingleWire draws 5 frames of 60 ms.
+const int BODY_CORD_GOOD_PASSES = 2;
+const double ANIMATE_WIRE_US = 5 * 60000.0;
+const double QUICK_CHECK_DELAYS_US = 500000.0 + 300000.0;
+
+const float OPEN = -1.0f;
+
+struct Network {
+    float ohm[NUM_PAIRS];  // OPEN or the resistance of the pair
+};
+
+struct Connection {
+    Pair_t pair;
+    float ohm;
+};
+
+// Everything open except `connections`
+Network makeNetwork(std::initializer_list<Connection> connections) {
+    Network network;
+    for (int p = 0; p < NUM_PAIRS; p++) {
+        network.ohm[p] = OPEN;
+    }
+    for (const Connection& connection : connections) {
+        network.ohm[connection.pair] = connection.ohm;
+    }
+    return network;
+}
+
+struct Scenario {
+    const char* name;
+    DetectedMode_t runningMode;  // Mode already running before the event, MODE_NONE: the waiting loop
+    bool express;                // Body cord with the ExpressCheck setting
+    Network before;
+    Network after;
+    DisplayCommand verdict;  // Ignored for the body cord
+    double p50BudgetMs;  // 0: modelled, not gated
+    double p99BudgetMs;
+};
+
+const Scenario scenarios[] = {
+    {"body cord",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_CR_CL, 0.5f}, {PAIR_AR_PISTE, 0.5f}, {PAIR_BR_BL, 0.5f}}),
+     {DISPLAY_CLEAR, SHAPE_NONE, COLOR_GREEN},
+     0,
+     0},
+    {"express",
+     MODE_NONE,
+     true,
+     makeNetwork({}),
+     makeNetwork({{PAIR_CR_CL, 0.5f}, {PAIR_AR_PISTE, 0.5f}, {PAIR_BR_BL, 0.5f}}),
+     {DISPLAY_CLEAR, SHAPE_NONE, COLOR_GREEN},
+     65,
+     80},
+    {"epee",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_AR_CR, 0.5f}}),
+     {DISPLAY_INNER9, SHAPE_SQUARE, COLOR_GREEN},
+     40,
+     52},
+    {"foil",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_AR_BR, 0.5f}}),
+     {DISPLAY_SHAPE, SHAPE_F, COLOR_GREEN},
+     40,
+     50},
+    {"foil tip",
+     MODE_FOIL,
+     false,
+     makeNetwork({{PAIR_AR_BR, 0.5f}}),
+     makeNetwork({}),
+     {DISPLAY_INNER9, SHAPE_SQUARE, COLOR_WHITE},
+     28,
+     38},
+    {"lame",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_BR_CR, 2.0f}}),
+     {DISPLAY_SHAPE, SHAPE_DIAMOND, COLOR_GREEN},
+     36,
+     48},
+    {"lame top",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_CR_CL, 2.0f}}),
+     {DISPLAY_SHAPE, SHAPE_DIAMOND, COLOR_GREEN},
+     44,
+     56},
+    {"reel",
+     MODE_NONE,
+     false,
+     makeNetwork({}),
+     makeNetwork({{PAIR_CL_PISTE, 5.0f}}),
+     {DISPLAY_SHAPE, SHAPE_R, COLOR_GREEN},
+     34,
+     46},
+};
+
+// The tester's view of the network: a clock that advances with every measurement
+class Simulation {
+   public:
+    Simulation(const Scenario& scenario, std::mt19937& random) : scenario(scenario), random(random) {
+        for (int p = 0; p < NUM_PAIRS; p++) {
+            values[p] = OPEN_MV;
+        }
+    }
+
+    double nowUs = 0.0;
+    double eventUs = 0.0;
+    int values[NUM_PAIRS];
+
+    void measure(Pair_t pair) {
+        nowUs += PAIR_US;
+        const Network* network = nowUs < eventUs ? &scenario.before : &scenario.after;
+        if (nowUs >= eventUs && nowUs < eventUs + BOUNCE_US && std::bernoulli_distribution(0.5)(random)) {
+            network = &scenario.before;
+        }
+        float ohm = network->ohm[pair];
+        float mv = ohm == OPEN ? OPEN_MV : ohm * OHM_MV;
+        values[pair] = (int)(mv + noise(random));
+    }
+
+    void fullScan() {
+        for (int p = 0; p < 9; p++) {
+            measure((Pair_t)p);
+        }
+    }
+
+    // scanScheduled(): the hot entries, then coldPerScan cold entries round-robin
+    void scheduledScan(const ScanSchedule& schedule) {
+        for (int p = 0; p < 9; p++) {
+            if (schedule.hotMask & (1 << p)) {
+                measure((Pair_t)p);
+            }
+        }
+        for (int done = 0; (schedule.coldMask & SCAN_ALL) && done < schedule.coldPerScan;) {
+            coldCursor = (coldCursor + 1) % 9;
+            if (schedule.coldMask & (1 << coldCursor)) {
+                measure((Pair_t)coldCursor);
+                done++;
+            }
+        }
+    }
+
+    TesterFrame frame() const {
+        TesterFrame result;
+        for (int p = 0; p < NUM_PAIRS; p++) {
+            result.pairs[p] = values[p];
+        }
+        result.timeMs = (uint32_t)(nowUs / 1000.0);
+        return result;
+    }
+
+   private:
+    const Scenario& scenario;
+    std::mt19937& random;
+    std::normal_distribution<float> noise{0.0f, NOISE_MV};
+    int coldCursor = 0;
+};
+
+TesterThresholds makeThresholds() {
+    TesterThresholds thresholds;
+    for (int i = 0; i < 11; i++) {
+        thresholds.ohm[i] = i * OHM_MV;
+    }
+    thresholds.ohm20 = 20 * OHM_MV;
+    thresholds.ohm25 = 25 * OHM_MV;
+    thresholds.ohm50 = 50 * OHM_MV;
+    return thresholds;
+}
+
+ScanSchedule scheduleFor(DetectedMode_t mode) {
+    switch (mode) {
+        case MODE_FOIL:
+            return SCAN_FOIL;
+        case MODE_LAME:
+            return SCAN_LAME;
+        case MODE_LAME_TOP:
+            return SCAN_LAME_TOP;
+        default:
+            return SCAN_EPEE;
+    }
+}
+
+// handleWaitingState until classifyFrame sees something, returns the mode
+DetectedMode_t waitForDetection(Simulation& sim, const TesterThresholds& thresholds) {
+    while (sim.nowUs < sim.eventUs + TIMEOUT_US) {
+        sim.fullScan();
+        for (Pair_t pair : {PAIR_AR_CR, PAIR_AR_BR, PAIR_BR_CR, PAIR_CL_PISTE}) {
+            sim.measure(pair);
+        }
+        DetectedMode_t mode = classifyFrame(sim.frame(), thresholds, thresholds.ohm[10]);
+        if (mode != MODE_NONE && sim.nowUs >= sim.eventUs) {
+            return mode;
+        }
+        sim.nowUs += TASK_DELAY_US;
+    }
+    return MODE_NONE;
+}
+
+// doExpressCheck up to the verdict frame: ExpressCordCheck ticked once per task loop pass on a full scan. Returns
+// false when the verdict is not all green.
+bool expressCheck(Simulation& sim, const TesterThresholds& thresholds) {
+    const CordReferences references = {thresholds.ohm[10], thresholds.ohm[1], thresholds.ohm[3], CONNECTED_MV};
+    ExpressCordCheck check;
+    check.start(sim.frame().timeMs);
+    while (sim.nowUs < sim.eventUs + TIMEOUT_US) {
+        sim.nowUs += TASK_DELAY_US;
+        sim.fullScan();
+        int measurements[3][3];
+        bool pluggedIn = false;
+        for (int p = 0; p < 9; p++) {
+            measurements[p / 3][p % 3] = sim.values[p];
+            pluggedIn |= sim.values[p] < references.broken;
+        }
+        if (check.tick(measurements, references, pluggedIn, sim.frame().timeMs) == EXPRESS_VERDICT) {
+            return check.level(0) == 0 && check.level(1) == 0 && check.level(2) == 0;
+        }
+    }
+    return false;
+}
+
+// Time to verdict in us, negative when the verdict never showed
+double runTrial(const Scenario& scenario, std::mt19937& random) {
+    TesterThresholds thresholds = makeThresholds();
+    Simulation sim(scenario, random);
+    TesterStateMachine machine;
+    machine.setThresholds(thresholds);
+
+    double passUs = 13 * PAIR_US + TASK_DELAY_US;
+    DetectedMode_t mode = scenario.runningMode;
+    if (mode == MODE_NONE) {
+        // Plugged in at a random point of a waiting pass
+        sim.eventUs = std::uniform_real_distribution<double>(0.0, passUs)(random);
+        mode = waitForDetection(sim, thresholds);
+        if (mode == MODE_BODY_CORD && scenario.express) {
+            return expressCheck(sim, thresholds) ? sim.nowUs - sim.eventUs : -1.0;
+        }
+        if (mode == MODE_BODY_CORD) {
+            for (int pass = 0; pass < BODY_CORD_GOOD_PASSES + 1; pass++) {
+                sim.nowUs += (pass < BODY_CORD_GOOD_PASSES ? 18 : 9) * PAIR_US;
+                sim.nowUs += 3 * ANIMATE_WIRE_US + QUICK_CHECK_DELAYS_US + TASK_DELAY_US;
+            }
+            sim.nowUs += 3 * PAIR_US;  // testStraightOnly
+            return sim.nowUs - sim.eventUs;
+        }
+        if (mode == MODE_NONE) {
+            return -1.0;
+        }
+        sim.fullScan();  // enterSpecialMode
+        machine.enter(mode, sim.frame().timeMs);
+        sim.nowUs += TASK_DELAY_US;
+    } else {
+        // The mode has been running for a while, the event falls at a random point of a tick
+        machine.enter(mode, 0);
+        sim.eventUs = 500000.0 + std::uniform_real_distribution<double>(0.0, passUs)(random);
+    }
+
+    ScanSchedule schedule = scheduleFor(mode);
+    while (machine.isActive() && sim.nowUs < sim.eventUs + TIMEOUT_US) {
+        sim.scheduledScan(schedule);
+        for (int p = 0; p < NUM_PAIRS; p++) {
+            if (machine.pairsToRead() & (1 << p)) {
+                sim.measure((Pair_t)p);
+            }
+        }
+        DisplayCommand commands[MAX_DISPLAY_COMMANDS];
+        int count = machine.tick(sim.frame(), commands);
+        for (int i = 0; i < count; i++) {
+            const DisplayCommand& command = commands[i];
+            if (sim.nowUs >= sim.eventUs && command.op == scenario.verdict.op &&
+                command.shape == scenario.verdict.shape && command.color == scenario.verdict.color) {
+                return sim.nowUs - sim.eventUs;
+            }
+        }
+        sim.nowUs += TASK_DELAY_US;
+    }
+    return -1.0;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    return sorted[(size_t)(fraction * (sorted.size() - 1) + 0.5)];
+}
+
+int main() {
+    std::mt19937 random(12345);
+    int failures = 0;
+    printf("Time to verdict, %d trials per scenario, %.0f us per pair, %.0f ms task delay\n", TRIALS, PAIR_US,
+           TASK_DELAY_US / 1000.0);
+    printf("  %-10s %9s %9s %9s   %s\n", "scenario", "p50 ms", "p99 ms", "max ms", "budget p50/p99");
+    for (const Scenario& scenario : scenarios) {
+        std::vector<double> latencies;
+        int missed = 0;
+        for (int trial = 0; trial < TRIALS; trial++) {
+            double latency = runTrial(scenario, random);
+            if (latency < 0.0) {
+                missed++;
+            } else {
+                latencies.push_back(latency / 1000.0);
+            }
+        }
+        if (latencies.empty()) {
+            printf("  %-10s no verdict in any trial  FAIL\n", scenario.name);
+            failures++;
+            continue;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = percentile(latencies, 0.50);
+        double p99 = percentile(latencies, 0.99);
+        bool gated = scenario.p50BudgetMs > 0.0;
+        bool failed = missed > 0 || (gated && (p50 > scenario.p50BudgetMs || p99 > scenario.p99BudgetMs));
+        printf("  %-10s %9.1f %9.1f %9.1f   ", scenario.name, p50, p99, latencies.back());
+        if (gated) {
+            printf("%.0f/%.0f%s", scenario.p50BudgetMs, scenario.p99BudgetMs, failed ? "  FAIL" : "");
+        } else {
+            printf("modelled%s", failed ? "  FAIL" : "");
+        }
+        if (missed) {
+            printf(", %d trials without verdict", missed);
+        }
+        printf("\n");
+        failures += failed;
+    }
+    printf("%d regression(s)\n", failures);
+    return failures ? 1 : 0;
+}